@@ -1102,7 +1102,7 @@ void compiler::makeBlockBytecode(AST::NodeList& block, RegManager& reg, AST::Sco
 
 		switch (elem->type) {
 			case NodeType::CURLY_GROUP:
-				// TODO : something different for function definitions (new stack frame)
+				// TODO : something different for function definitions (new stack frame, made by CALL with the caller's frame size and left by RET)
 				nodeCurlyGroup = static_cast<NodeCurlyGroup*>(elem);
 				makeBlockBytecode(nodeCurlyGroup->nodeList, reg, globalScope, nodeCurlyGroup->scope, outputFile, byteCounter, compileSettings, stream);
 				break;
@@ -1361,6 +1361,8 @@ How to do scopes in the AST:
 Then in the bytecode:
 - The bytecode maker will have access to the same `Scope` and `ExprIdentifier` objects, so it can easily sort out what refers to what
 - For each `Scope` object a stack frame will be created? Or perhaps only for functions, and then other scopes (like in if statements) will build on the current stack
+- Function frames should come from `call @function, frameSize` and `ret`, which lay them out like the assembly examples do (saved BP, then
+	return IP, then arguments) in one instruction each, and which the executor predicts returns for. Arguments go at the new BP + 8 and up.
 
 OR I choose not to have block-scoping but just function-scoping, in which case I have to figure out how to actually do that (i.e. how to identify which blocks are functions and which aren't)
 */
\ No newline at end of file
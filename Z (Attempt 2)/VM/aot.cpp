@@ -0,0 +1,686 @@
+#include "aot.h"
+
+#include <algorithm>
+#include <climits>
+#include <sstream>
+
+using std::cout;
+using vm::executor::Instr;
+
+namespace {
+	using namespace vm::executor;
+	using namespace types;
+
+	// Everything the generated file needs besides the program itself
+	// Errors and the end of the program print exactly what exec and exec_ do
+	constexpr const char* const prelude =
+		"#include <stdint.h>\n"
+		"#include <stdio.h>\n"
+		"#include <stdlib.h>\n"
+		"#include <string.h>\n"
+		"#include <math.h>\n"
+		"#include <time.h>\n"
+		"#include <signal.h>\n"
+		"#ifdef _WIN32\n"
+		"#include <windows.h>\n"
+		"#else\n"
+		"#include <sys/mman.h>\n"
+		"#endif\n"
+		"\n"
+		"#if UINTPTR_MAX <= 0xffffffffu\n"
+		"#error \"Word addresses are offsets into a 4GB reservation, which needs a 64-bit host\"\n"
+		"#endif\n"
+		"\n"
+		"typedef union { int32_t i; float f; } Word;\n"
+		"typedef union { int32_t i[4]; float f[4]; } Vec;\n"
+		"\n"
+		"/* Linear memory, laid out like the interpreter's (see vm::executor::Memory) */\n"
+		"#define SPAN 0x100000000ull\n"
+		"#define GRANULE 0x10000u\n"
+		"static char* mem;\n"
+		"static uint64_t top = GRANULE;\n"
+		"\n"
+		"static inline char* at(int32_t base, int32_t offset) {\n"
+		"\treturn mem + ((uint32_t)base + (uint32_t)offset);\n"
+		"}\n"
+		"\n"
+		"/* Volatile, so a load whose result goes unused still faults where the interpreter's would */\n"
+		"#ifdef __GNUC__\n"
+		"typedef int32_t Unaligned __attribute__((aligned(1), may_alias));\n"
+		"#else\n"
+		"typedef int32_t Unaligned;\n"
+		"#endif\n"
+		"\n"
+		"static inline int32_t loadWord(int32_t base, int32_t offset) {\n"
+		"\treturn *(const volatile Unaligned*)at(base, offset);\n"
+		"}\n"
+		"\n"
+		"static inline void storeWord(int32_t base, int32_t offset, int32_t v) {\n"
+		"\t*(volatile Unaligned*)at(base, offset) = v;\n"
+		"}\n"
+		"\n"
+		"static inline void fail(int loc, const char* what) {\n"
+		"\tprintf(\"\\033[31m[ERROR] Error during execution at BYTE%d : %s\\033[0m\\n\\n\\n\", loc, what);\n"
+		"\texit(1);\n"
+		"}\n"
+		"\n"
+		"#define DIVIDE_BY_ZERO \"Division (or modulo) by zero\"\n"
+		"#define BAD_ALLOC \"Dynamic memory allocation error : std::bad_alloc\"\n"
+		"#define OUT_OF_BOUNDS \"Memory access out of bounds\"\n"
+		"\n"
+		"/* Read whole before it's copied, like READ_STR, so a line running out of bounds faults outside stdio */\n"
+		"static void readLine(char* out, int loc) {\n"
+		"\tstatic char* line;\n"
+		"\tstatic size_t capacity;\n"
+		"\tsize_t n = 0;\n"
+		"\tint c;\n"
+		"\tfflush(stdout);\n"
+		"\twhile ((c = getchar()) != '\\n' && c != EOF) {\n"
+		"\t\tif (n + 1 >= capacity) {\n"
+		"\t\t\tcapacity = capacity == 0 ? 256 : capacity * 2;\n"
+		"\t\t\tline = (char*)realloc(line, capacity);\n"
+		"\t\t\tif (line == NULL) fail(loc, BAD_ALLOC);\n"
+		"\t\t}\n"
+		"\t\tline[n++] = (char)c;\n"
+		"\t}\n"
+		"\tif (line == NULL) {\n"
+		"\t\t*out = 0;\n"
+		"\t\treturn;\n"
+		"\t}\n"
+		"\tline[n] = 0;\n"
+		"\tmemcpy(out, line, n + 1);\n"
+		"}\n"
+		"\n"
+		"/* An access the host faults on, reported from the instruction that made it like exec_'s trap does: a stack overflow\n"
+		"   if it's in the guard after the stack, otherwise out of bounds. Every instruction that accesses memory sets current */\n"
+		"static volatile sig_atomic_t current;\n"
+		"static uint64_t stackEnd;\n"
+		"\n"
+		"static void faultAt(const char* addr) {\n"
+		"\tchar what[80];\n"
+		"\tconst uint64_t offset = (uint64_t)(addr - mem);\n"
+		"\tif (offset >= stackEnd && offset < stackEnd + GRANULE) snprintf(what, sizeof(what), \"Stack overflow : address %llu is past the stack limit\", (unsigned long long)offset);\n"
+		"\telse snprintf(what, sizeof(what), OUT_OF_BOUNDS \" : address %llu\", (unsigned long long)offset);\n"
+		"\tfail((int)current, what);\n"
+		"}\n"
+		"\n"
+		"#ifdef _WIN32\n"
+		"static LONG CALLBACK onFault(EXCEPTION_POINTERS* e) {\n"
+		"\tconst char* addr = (const char*)e->ExceptionRecord->ExceptionInformation[1];\n"
+		"\tif (e->ExceptionRecord->ExceptionCode == EXCEPTION_ACCESS_VIOLATION && addr >= mem && addr < mem + SPAN + GRANULE) faultAt(addr);\n"
+		"\treturn EXCEPTION_CONTINUE_SEARCH;\n"
+		"}\n"
+		"#else\n"
+		"static void onFault(int sig, siginfo_t* info, void* context) {\n"
+		"\tconst char* addr = (const char*)info->si_addr;\n"
+		"\t(void)context;\n"
+		"\tif (addr >= mem && addr < mem + SPAN + GRANULE) faultAt(addr);\n"
+		"\t/* Anything else faults again, and ends the program the way it would have */\n"
+		"\tsignal(sig, SIG_DFL);\n"
+		"}\n"
+		"#endif\n"
+		"\n"
+		"/* The size bytes at base, for the bulk memory opcodes, which must end inside the span like the VM's */\n"
+		"static inline char* range(int32_t base, uint64_t size, int loc) {\n"
+		"\tif ((uint32_t)base + size > SPAN) fail(loc, OUT_OF_BOUNDS);\n"
+		"\treturn mem + (uint32_t)base;\n"
+		"}\n"
+		"\n"
+		"/* The string opcodes. Length-prefixed strings are a word holding the length, then the null-terminated string */\n"
+		"static inline int32_t addressOf(const char* p) {\n"
+		"\treturn (int32_t)(uint32_t)(p - mem);\n"
+		"}\n"
+		"\n"
+		"static inline int8_t order(int r) {\n"
+		"\treturn (int8_t)((r > 0) - (r < 0));\n"
+		"}\n"
+		"\n"
+		"static inline uint64_t prefixed(int32_t s) {\n"
+		"\treturn (uint32_t)loadWord(s, 0);\n"
+		"}\n"
+		"\n"
+		"static inline int32_t chars(int32_t s) {\n"
+		"\treturn (int32_t)((uint32_t)s + 4u);\n"
+		"}\n"
+		"\n"
+		"static int lstrCompare(int32_t a, int32_t b, int loc) {\n"
+		"\tconst uint64_t la = prefixed(a), lb = prefixed(b), n = la < lb ? la : lb;\n"
+		"\tconst int r = memcmp(range(chars(a), n, loc), range(chars(b), n, loc), (size_t)n);\n"
+		"\treturn r != 0 ? r : (la > lb) - (la < lb);\n"
+		"}\n"
+		"\n"
+		"static void reserve(void) {\n"
+		"#ifdef _WIN32\n"
+		"\tmem = (char*)VirtualAlloc(NULL, SPAN + GRANULE, MEM_RESERVE, PAGE_NOACCESS);\n"
+		"#else\n"
+		"\tmem = (char*)mmap(NULL, SPAN + GRANULE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);\n"
+		"\tif (mem == (char*)MAP_FAILED) mem = NULL;\n"
+		"#endif\n"
+		"\tif (mem == NULL) fail(0, BAD_ALLOC);\n"
+		"#ifdef _WIN32\n"
+		"\tAddVectoredExceptionHandler(1, onFault);\n"
+		"#else\n"
+		"\t{\n"
+		"\t\tstruct sigaction action;\n"
+		"\t\tmemset(&action, 0, sizeof(action));\n"
+		"\t\taction.sa_sigaction = onFault;\n"
+		"\t\taction.sa_flags = SA_SIGINFO;\n"
+		"\t\tsigaction(SIGSEGV, &action, NULL);\n"
+		"\t\tsigaction(SIGBUS, &action, NULL);\n"
+		"\t}\n"
+		"#endif\n"
+		"}\n"
+		"\n"
+		"/* Offset of size accessible bytes at the next GRANULE, optionally followed by an inaccessible one */\n"
+		"static int32_t region(uint64_t size, int guarded, int loc) {\n"
+		"\tconst uint64_t offset = top;\n"
+		"\tconst uint64_t end = (offset + size + GRANULE - 1) / GRANULE * GRANULE + (guarded ? GRANULE : 0);\n"
+		"\tif (end > SPAN) fail(loc, BAD_ALLOC);\n"
+		"#ifdef _WIN32\n"
+		"\tif (size > 0 && VirtualAlloc(mem + offset, size, MEM_COMMIT, PAGE_READWRITE) == NULL) fail(loc, BAD_ALLOC);\n"
+		"#else\n"
+		"\tif (size > 0 && mprotect(mem + offset, size, PROT_READ | PROT_WRITE) != 0) fail(loc, BAD_ALLOC);\n"
+		"#endif\n"
+		"\ttop = end;\n"
+		"\treturn (int32_t)offset;\n"
+		"}\n"
+		"\n"
+		"/* ALLOC and FREE: power-of-two size classes with free lists and an 8 byte header, like vm::executor::Heap */\n"
+		"static int32_t freeLists[29];\n"
+		"static char* bump;\n"
+		"static char* bumpEnd;\n"
+		"\n"
+		"/* Which GRANULEs the heap has taken, for Heap::owns' checks of the addresses FREE and ALLOC are handed */\n"
+		"static uint8_t heapGranules[SPAN / GRANULE];\n"
+		"\n"
+		"static int32_t heapRegion(uint64_t size, int loc) {\n"
+		"\tconst int32_t offset = region(size, 0, loc);\n"
+		"\tmemset(heapGranules + (uint32_t)offset / GRANULE, 1, (size_t)((size + GRANULE - 1) / GRANULE));\n"
+		"\treturn offset;\n"
+		"}\n"
+		"\n"
+		"static int heapOwns(int32_t p, uint64_t size) {\n"
+		"\tconst uint64_t from = (uint32_t)p - 8u;\n"
+		"\tuint64_t g;\n"
+		"\tif (from + 8 + size > SPAN) return 0;\n"
+		"\tfor (g = from / GRANULE; g <= (from + 8 + size - 1) / GRANULE; g++) {\n"
+		"\t\tif (!heapGranules[g]) return 0;\n"
+		"\t}\n"
+		"\treturn 1;\n"
+		"}\n"
+		"\n"
+		"static int32_t heapAlloc(int32_t n, int loc) {\n"
+		"\tint c = 0;\n"
+		"\tint32_t p;\n"
+		"\tif (n < 0) fail(loc, \"Dynamic memory allocation error : std::bad_array_new_length\");\n"
+		"\twhile (((uint64_t)8 << c) < (uint64_t)n) c++;\n"
+		"\tp = freeLists[c];\n"
+		"\tif (p != 0) {\n"
+		"\t\tif (!heapOwns(p, (uint64_t)8 << c)) fail(loc, \"Dynamic memory allocation error : a freed block has been overwritten\");\n"
+		"\t\tfreeLists[c] = loadWord(p, 0);\n"
+		"\t} else if (((uint64_t)8 << c) <= 0x800) {\n"
+		"\t\tconst uint64_t slot = 8 + ((uint64_t)8 << c);\n"
+		"\t\tif ((uint64_t)(bumpEnd - bump) < slot) {\n"
+		"\t\t\tbump = mem + (uint32_t)heapRegion(0x10000, loc);\n"
+		"\t\t\tbumpEnd = bump + 0x10000;\n"
+		"\t\t}\n"
+		"\t\tp = (int32_t)(bump - mem) + 8;\n"
+		"\t\tbump += slot;\n"
+		"\t} else {\n"
+		"\t\tp = heapRegion(8 + ((uint64_t)8 << c), loc) + 8;\n"
+		"\t}\n"
+		"\tstoreWord(p, -8, c);\n"
+		"\tstoreWord(p, -4, n);\n"
+		"\treturn p;\n"
+		"}\n"
+		"\n"
+		"static void heapFree(int32_t p, int loc) {\n"
+		"\tint32_t c;\n"
+		"\tif (p == 0) return;\n"
+		"\tif (!heapOwns(p, 4)) {\n"
+		"\t\tchar what[80];\n"
+		"\t\tsnprintf(what, sizeof(what), OUT_OF_BOUNDS \" : address %u was never allocated\", (unsigned)(uint32_t)p);\n"
+		"\t\tfail(loc, what);\n"
+		"\t}\n"
+		"\tc = loadWord(p, -8);\n"
+		"\tif ((uint32_t)c >= 29) fail(loc, \"Dynamic memory allocation error : the header before the freed block has been overwritten\");\n"
+		"\tif (loadWord(p, -4) == -1) fail(loc, \"Dynamic memory allocation error : the block has already been freed\");\n"
+		"\tstoreWord(p, -4, -1);\n"
+		"\tstoreWord(p, 0, freeLists[c]);\n"
+		"\tfreeLists[c] = p;\n"
+		"}\n"
+		"\n";
+
+	std::string intLiteral(word_t v) {
+		return v == INT_MIN ? "(-2147483647 - 1)" : std::to_string(v);
+	}
+
+	class Translator {
+	public:
+		Translator(const Program& program, const WordVal* wordReg, const ByteVal* byteReg, const VecVal* vecReg, std::ostream& out) :
+			program(program), wordReg(wordReg), byteReg(byteReg), vecReg(vecReg), out(out) {}
+
+		// One statement for instrs[i], which falls through to instrs[i + 1] like the handlers return ip + 1
+		void statement(size_t i) {
+			using namespace opcode;
+			using namespace execop;
+
+			const Instr& in = program.instrs[i];
+			// Where exec_ reports errors from, see ExecutorException
+			const int next = i + 1 < program.instrs.size() ? program.instrs[i + 1].loc : in.loc;
+
+			if (accesses(in)) out << "current = " << in.loc << "; ";
+
+			switch (in.op) {
+				case NOP: out << ";"; break;
+				case HALT: out << "goto halt_;"; break;
+				case BREAK: out << "{ int c; fflush(stdout); while ((c = getchar()) != '\\n' && c != EOF); }"; break;
+
+				case ALLOC: out << W(in.a) << " = heapAlloc(" << W(in.b) << ", " << next << ");"; break;
+				case FREE: out << "heapFree(" << W(in.a) << ", " << next << ");"; break;
+
+				case R_MOV_W: out << reg(in.a) << " = " << reg(in.b) << ";"; break;
+				case R_MOV_B: out << B(in.a) << " = " << B(in.b) << ";"; break;
+				case MOV_W: out << W(in.a) << " = " << intLiteral(in.imm) << ";"; break;
+				case MOV_B: out << B(in.a) << " = " << static_cast<int>(static_cast<byte_t>(in.imm)) << ";"; break;
+
+				case LOAD_W: out << W(in.a) << " = loadWord(" << W(in.b) << ", " << intLiteral(in.imm) << ");"; break;
+				case STORE_W: out << "storeWord(" << W(in.a) << ", " << intLiteral(in.imm) << ", " << W(in.b) << ");"; break;
+				case LOAD_B: out << B(in.a) << " = *(volatile int8_t*)at(" << W(in.b) << ", " << intLiteral(in.imm) << ");"; break;
+				case STORE_B: out << "*(volatile int8_t*)at(" << W(in.a) << ", " << intLiteral(in.imm) << ") = " << B(in.b) << ";"; break;
+
+				case JMP: out << "goto " << label(in.target) << ";"; break;
+				case JMP_Z: out << "if (!FZ) goto " << label(in.target) << ";"; break;
+				case JMP_NZ: out << "if (FZ) goto " << label(in.target) << ";"; break;
+				case R_JMP: out << "{ target = " << W(in.a) << "; goto dispatch_; }"; break;
+				case R_JMP_Z: out << "if (!FZ) { target = " << W(in.a) << "; goto dispatch_; }"; break;
+				case R_JMP_NZ: out << "if (FZ) { target = " << W(in.a) << "; goto dispatch_; }"; break;
+				case CALL: {
+					const std::string bp = reg(register_::BP) + ".i";
+					out << "{ const int32_t f = (int32_t)((uint32_t)" << bp << " + " << static_cast<uint32_t>(in.imm) << "u); storeWord(f, 0, " << bp << "); storeWord(f, 4, " << next << "); "
+						<< bp << " = f; } goto " << label(in.target) << ";";
+					break;
+				}
+				case RET: {
+					const std::string bp = reg(register_::BP) + ".i";
+					out << "{ const int32_t f = " << bp << "; target = loadWord(f, 4); " << bp << " = loadWord(f, 0); goto dispatch_; }";
+					break;
+				}
+
+				case I_FLAG: out << "FZ = " << W(in.a) << " != 0;"; break;
+				case I_CMP_EQ: compare(W(in.a), "==", W(in.b)); break;
+				case I_CMP_NE: compare(W(in.a), "!=", W(in.b)); break;
+				case I_CMP_GT: compare(W(in.a), ">", W(in.b)); break;
+				case I_CMP_LT: compare(W(in.a), "<", W(in.b)); break;
+				case I_CMP_GE: compare(W(in.a), ">=", W(in.b)); break;
+				case I_CMP_LE: compare(W(in.a), "<=", W(in.b)); break;
+
+				// Wrapping arithmetic, as the interpreter gets in practice
+				case I_INC: setFlag(W(in.a), W(in.a) + " = (int32_t)((uint32_t)" + W(in.a) + " + 1u);"); break;
+				case I_DEC: setFlag(W(in.a), W(in.a) + " = (int32_t)((uint32_t)" + W(in.a) + " - 1u);"); break;
+				case I_ADD: setFlag(W(in.a), W(in.a) + " = (int32_t)((uint32_t)" + W(in.b) + " + (uint32_t)" + W(in.c) + ");"); break;
+				case I_SUB: setFlag(W(in.a), W(in.a) + " = (int32_t)((uint32_t)" + W(in.b) + " - (uint32_t)" + W(in.c) + ");"); break;
+				case I_MUL: setFlag(W(in.a), W(in.a) + " = (int32_t)((uint32_t)" + W(in.b) + " * (uint32_t)" + W(in.c) + ");"); break;
+				case I_DIV: divide(W(in.c), next, W(in.a) + " = " + W(in.b) + " / " + W(in.c) + ";", W(in.a)); break;
+				case I_MOD: divide(W(in.c), next, W(in.a) + " = " + W(in.b) + " % " + W(in.c) + ";", W(in.a)); break;
+				case I_TO_C: out << B(in.a) << " = (int8_t)" << W(in.b) << ";"; break;
+				case I_TO_F: out << F(in.a) << " = (float)" << W(in.b) << ";"; break;
+
+				case C_FLAG: out << "FZ = " << B(in.a) << " != 0;"; break;
+				case C_CMP_EQ: compare(B(in.a), "==", B(in.b)); break;
+				case C_CMP_NE: compare(B(in.a), "!=", B(in.b)); break;
+				case C_CMP_GT: compare(B(in.a), ">", B(in.b)); break;
+				case C_CMP_LT: compare(B(in.a), "<", B(in.b)); break;
+				case C_CMP_GE: compare(B(in.a), ">=", B(in.b)); break;
+				case C_CMP_LE: compare(B(in.a), "<=", B(in.b)); break;
+
+				case C_INC: setFlag(B(in.a), B(in.a) + " = (int8_t)(" + B(in.a) + " + 1);"); break;
+				case C_DEC: setFlag(B(in.a), B(in.a) + " = (int8_t)(" + B(in.a) + " - 1);"); break;
+				case C_ADD: setFlag(B(in.a), B(in.a) + " = (int8_t)(" + B(in.b) + " + " + B(in.c) + ");"); break;
+				case C_SUB: setFlag(B(in.a), B(in.a) + " = (int8_t)(" + B(in.b) + " - " + B(in.c) + ");"); break;
+				case C_MUL: setFlag(B(in.a), B(in.a) + " = (int8_t)(" + B(in.b) + " * " + B(in.c) + ");"); break;
+				case C_DIV: divide(B(in.c), next, B(in.a) + " = (int8_t)(" + B(in.b) + " / " + B(in.c) + ");", B(in.a)); break;
+				case C_MOD: divide(B(in.c), next, B(in.a) + " = (int8_t)(" + B(in.b) + " % " + B(in.c) + ");", B(in.a)); break;
+				case C_TO_I: out << W(in.a) << " = " << B(in.b) << ";"; break;
+				case C_TO_F: out << F(in.a) << " = (float)" << B(in.b) << ";"; break;
+
+				case F_FLAG: out << "FZ = " << F(in.a) << " != 0;"; break;
+				case F_CMP_EQ: compare(F(in.a), "==", F(in.b)); break;
+				case F_CMP_NE: compare(F(in.a), "!=", F(in.b)); break;
+				case F_CMP_GT: compare(F(in.a), ">", F(in.b)); break;
+				case F_CMP_LT: compare(F(in.a), "<", F(in.b)); break;
+				case F_CMP_GE: compare(F(in.a), ">=", F(in.b)); break;
+				case F_CMP_LE: compare(F(in.a), "<=", F(in.b)); break;
+
+				case F_ADD: setFlag(F(in.a), F(in.a) + " = " + F(in.b) + " + " + F(in.c) + ";"); break;
+				case F_SUB: setFlag(F(in.a), F(in.a) + " = " + F(in.b) + " - " + F(in.c) + ";"); break;
+				case F_MUL: setFlag(F(in.a), F(in.a) + " = " + F(in.b) + " * " + F(in.c) + ";"); break;
+				case F_DIV: divide(F(in.c), next, F(in.a) + " = " + F(in.b) + " / " + F(in.c) + ";", F(in.a)); break;
+				case F_MOD: divide(F(in.c), next, "{ float t; " + F(in.a) + " = " + F(in.b) + " * modff(" + F(in.b) + " / " + F(in.c) + ", &t); }", F(in.a)); break;
+				case F_TO_I: out << W(in.a) << " = (int32_t)" << F(in.b) << ";"; break;
+				case F_TO_C: out << B(in.a) << " = (int8_t)" << F(in.b) << ";"; break;
+
+				case PRNT_C: out << "putchar(" << B(in.a) << ");"; break;
+				// Measured first, so a string running out of bounds faults outside stdio
+				case PRNT_STR: out << "{ const char* s = at(" << W(in.a) << ", " << intLiteral(in.imm) << "); fwrite(s, 1, strlen(s), stdout); }"; break;
+				case READ_C: out << "fflush(stdout); " << B(in.a) << " = (int8_t)getchar();"; break;
+				case READ_STR: out << "readLine(at(" << W(in.a) << ", " << intLiteral(in.imm) << "), " << next << ");"; break;
+				case R_PRNT_I: out << "printf(\"%d\", " << W(in.a) << ");"; break;
+				case R_PRNT_F: out << "printf(\"%g\", " << F(in.a) << ");"; break;
+				case PRNT_LN: out << "putchar('\\n');"; break;
+				case TIME: out << W(in.a) << " = (int32_t)time(NULL);"; break;
+				case FLUSH: out << "fflush(stdout);"; break;
+
+				case MEM_CPY: bulk("memcpy", range(W(in.a), W(in.c), next), range(W(in.b), W(in.c), next), W(in.c)); break;
+				case MEM_MOVE: bulk("memmove", range(W(in.a), W(in.c), next), range(W(in.b), W(in.c), next), W(in.c)); break;
+				case MEM_SET: bulk("memset", range(W(in.a), W(in.c), next), "(uint8_t)" + B(in.b), W(in.c)); break;
+				case MEM_CMP:
+					out << "{ int r = " << W(in.c) << " > 0 ? memcmp(" << range(W(in.a), W(in.c), next) << ", " << range(W(in.b), W(in.c), next) << ", (size_t)" << W(in.c)
+						<< ") : 0; FZ = (int8_t)((r > 0) - (r < 0)); }";
+					break;
+
+				case V_LOAD: out << "memcpy(&" << V(in.a) << ", at(" << W(in.b) << ", " << intLiteral(in.imm) << "), sizeof(Vec));"; break;
+				case V_STORE: out << "memcpy(at(" << W(in.a) << ", " << intLiteral(in.imm) << "), &" << V(in.b) << ", sizeof(Vec));"; break;
+				case V_SPLAT: eachLane(V(in.a) + ".i[l] = " + W(in.b) + ";"); break;
+				case VI_ADD: eachLane(V(in.a) + ".i[l] = (int32_t)((uint32_t)" + V(in.b) + ".i[l] + (uint32_t)" + V(in.c) + ".i[l]);"); break;
+				case VI_SUB: eachLane(V(in.a) + ".i[l] = (int32_t)((uint32_t)" + V(in.b) + ".i[l] - (uint32_t)" + V(in.c) + ".i[l]);"); break;
+				case VI_MUL: eachLane(V(in.a) + ".i[l] = (int32_t)((uint32_t)" + V(in.b) + ".i[l] * (uint32_t)" + V(in.c) + ".i[l]);"); break;
+				case VI_DIV:
+					out << "{ int l; for (l = 0; l < 4; l++) if (" << V(in.c) << ".i[l] == 0) fail(" << next << ", DIVIDE_BY_ZERO); } ";
+					eachLane(V(in.a) + ".i[l] = " + V(in.b) + ".i[l] / " + V(in.c) + ".i[l];");
+					break;
+				case VI_MIN: eachLane(V(in.a) + ".i[l] = " + V(in.b) + ".i[l] < " + V(in.c) + ".i[l] ? " + V(in.b) + ".i[l] : " + V(in.c) + ".i[l];"); break;
+				case VI_MAX: eachLane(V(in.a) + ".i[l] = " + V(in.b) + ".i[l] > " + V(in.c) + ".i[l] ? " + V(in.b) + ".i[l] : " + V(in.c) + ".i[l];"); break;
+				case VI_SUM:
+					setFlag(W(in.a), W(in.a) + " = (int32_t)(((uint32_t)" + V(in.b) + ".i[0] + (uint32_t)" + V(in.b) + ".i[2]) + ((uint32_t)" + V(in.b) + ".i[1] + (uint32_t)" + V(in.b) + ".i[3]));");
+					break;
+				case VF_ADD: eachLane(V(in.a) + ".f[l] = " + V(in.b) + ".f[l] + " + V(in.c) + ".f[l];"); break;
+				case VF_SUB: eachLane(V(in.a) + ".f[l] = " + V(in.b) + ".f[l] - " + V(in.c) + ".f[l];"); break;
+				case VF_MUL: eachLane(V(in.a) + ".f[l] = " + V(in.b) + ".f[l] * " + V(in.c) + ".f[l];"); break;
+				case VF_DIV:
+					out << "{ int l; for (l = 0; l < 4; l++) if (" << V(in.c) << ".f[l] == 0) fail(" << next << ", DIVIDE_BY_ZERO); } ";
+					eachLane(V(in.a) + ".f[l] = " + V(in.b) + ".f[l] / " + V(in.c) + ".f[l];");
+					break;
+				case VF_MIN: eachLane(V(in.a) + ".f[l] = " + V(in.b) + ".f[l] < " + V(in.c) + ".f[l] ? " + V(in.b) + ".f[l] : " + V(in.c) + ".f[l];"); break;
+				case VF_MAX: eachLane(V(in.a) + ".f[l] = " + V(in.b) + ".f[l] > " + V(in.c) + ".f[l] ? " + V(in.b) + ".f[l] : " + V(in.c) + ".f[l];"); break;
+				case VF_SUM:
+					setFlag(F(in.a), F(in.a) + " = (" + V(in.b) + ".f[0] + " + V(in.b) + ".f[2]) + (" + V(in.b) + ".f[1] + " + V(in.b) + ".f[3]);");
+					break;
+
+				case STR_LEN: setFlag(W(in.a), W(in.a) + " = (int32_t)strlen(at(" + W(in.b) + ", 0));"); break;
+				case STR_CMP: out << "FZ = order(strcmp(at(" << W(in.a) << ", 0), at(" << W(in.b) << ", 0)));"; break;
+				case STR_CHR: setFlag(W(in.a), "{ const char* p = strchr(at(" + W(in.b) + ", 0), " + B(in.c) + "); " + W(in.a) + " = p != NULL ? addressOf(p) : 0; }"); break;
+				case STR_CPY: out << "{ const size_t n = strlen(at(" << W(in.b) << ", 0)) + 1; memcpy(" << range(W(in.a), "n", next) << ", at(" << W(in.b) << ", 0), n); }"; break;
+				case LSTR_CMP: out << "FZ = order(lstrCompare(" << W(in.a) << ", " << W(in.b) << ", " << next << "));"; break;
+				case LSTR_CHR:
+					setFlag(W(in.a), "{ const uint64_t n = prefixed(" + W(in.b) + "); const char* p = (const char*)memchr(" + range("chars(" + W(in.b) + ")", "n", next) + ", (uint8_t)"
+						+ B(in.c) + ", (size_t)n); " + W(in.a) + " = p != NULL ? addressOf(p) : 0; }");
+					break;
+				case LSTR_CPY:
+					out << "{ const uint64_t n = prefixed(" << W(in.b) << ") + 5; memcpy(" << range(W(in.a), "n", next) << ", " << range(W(in.b), "n", next) << ", (size_t)n); }";
+					break;
+
+				case BAD_OPCODE: out << "fail(" << in.loc + 1 << ", \"Unknown opcode\");"; break;
+				case BAD_REGISTER: out << "fail(" << next << ", \"Invalid register ID\");"; break;
+			}
+		}
+
+		// Whether instr can fault on an address it's given, which is reported from instr itself like the trap does
+		// ALLOC and FREE check their addresses first, like Heap
+		static bool accesses(const Instr& in) {
+			using namespace opcode;
+
+			switch (in.op) {
+				case LOAD_W: case STORE_W: case LOAD_B: case STORE_B: case V_LOAD: case V_STORE: case CALL: case RET:
+				case PRNT_STR: case READ_STR: case MEM_CPY: case MEM_MOVE: case MEM_SET: case MEM_CMP:
+				case STR_LEN: case STR_CMP: case STR_CHR: case STR_CPY: case LSTR_CMP: case LSTR_CHR: case LSTR_CPY:
+					return true;
+				default:
+					return false;
+			}
+		}
+
+		std::string label(int index) const {
+			return "I" + std::to_string(index);
+		}
+
+		// Register files, as locals the C compiler can keep in host registers
+		std::vector<bool> wordUsed = std::vector<bool>(register_::COUNT, false);
+		std::vector<bool> byteUsed = std::vector<bool>(register_::COUNT, false);
+		std::vector<bool> vecUsed = std::vector<bool>(register_::NUM_VECTOR_REGISTERS, false);
+
+	private:
+		const Program& program;
+		const WordVal* wordReg;
+		const ByteVal* byteReg;
+		const VecVal* vecReg;
+		std::ostream& out;
+
+		std::string reg(const Operand& o) {
+			return reg(static_cast<int>(o.word - wordReg));
+		}
+
+		std::string reg(int id) {
+			wordUsed[id] = true;
+			return "w" + std::to_string(id);
+		}
+
+		std::string W(const Operand& o) { return reg(o) + ".i"; }
+		std::string F(const Operand& o) { return reg(o) + ".f"; }
+
+		std::string B(const Operand& o) {
+			const int id = static_cast<int>(o.byte - byteReg);
+			byteUsed[id] = true;
+			return id == register_::FZ ? "FZ" : "b" + std::to_string(id);
+		}
+
+		std::string V(const Operand& o) {
+			const int id = static_cast<int>(o.vec - vecReg);
+			vecUsed[id] = true;
+			return "v" + std::to_string(id);
+		}
+
+		// The vector opcodes as loops over the lanes, which the C compiler vectorizes for whatever it targets
+		// Min, max and the sums match lanes, so results are the same as the interpreter's
+		void eachLane(const std::string& statement) {
+			out << "{ int l; for (l = 0; l < 4; l++) " << statement << " }";
+		}
+
+		void compare(const std::string& a, const char* op, const std::string& b) {
+			out << "FZ = " << a << " " << op << " " << b << ";";
+		}
+
+		void setFlag(const std::string& result, const std::string& statement) {
+			out << statement << " FZ = " << result << " != 0;";
+		}
+
+		void divide(const std::string& divisor, int next, const std::string& statement, const std::string& result) {
+			out << "if (" << divisor << " == 0) fail(" << next << ", DIVIDE_BY_ZERO); ";
+			setFlag(result, statement);
+		}
+
+		std::string range(const std::string& base, const std::string& length, int next) {
+			return "range(" + base + ", " + length + ", " + std::to_string(next) + ")";
+		}
+
+		// Lengths that aren't positive do nothing, like the handlers
+		void bulk(const char* function, const std::string& to, const std::string& from, const std::string& length) {
+			out << "if (" << length << " > 0) " << function << "(" << to << ", " << from << ", (size_t)" << length << ");";
+		}
+	};
+}
+
+int vm::aot::translate(const char* const& bytecodePath, const char* const& outputPath, executor::ExecutorSettings& execSettings) {
+	cout << IO_MAIN "Attempting to translate file \"" << bytecodePath << "\" into output file \"" << outputPath << "\"\n" IO_NORM;
+
+	std::fstream bytecodeFile, outputFile;
+
+	bytecodeFile.open(bytecodePath, std::ios::in | std::ios::binary);
+	if (!bytecodeFile.is_open()) {
+		cout << IO_ERR "Could not open file \"" << bytecodePath << "\"" IO_NORM IO_END;
+		return 1;
+	}
+
+	outputFile.open(outputPath, std::ios::out | std::ios::trunc);
+	if (!outputFile.is_open()) {
+		cout << IO_ERR "Could not open file \"" << outputPath << "\"" IO_NORM IO_END;
+		return 1;
+	}
+
+	int out = vm::aot::translate_(bytecodeFile, outputFile, execSettings);
+	cout << IO_MAIN "Translation finished with code: " << out << IO_NORM IO_END;
+	return out;
+}
+
+int vm::aot::translate_(std::iostream& bytecodeFile, std::ostream& outputFile, executor::ExecutorSettings& execSettings) {
+	using namespace opcode;
+
+	WordVal wordReg[register_::COUNT];
+	ByteVal byteReg[register_::COUNT];
+	VecVal vecReg[register_::NUM_VECTOR_REGISTERS];
+
+	Program program(bytecodeFile);
+	program.decode(wordReg, byteReg, vecReg, false);
+
+	// Static jumps only reach what decode() found, but R_JMP can land on any instruction, so also decode every
+	// instruction boundary the way disassemble_ walks them
+	const int length = static_cast<int>(program.end - program.start);
+	program.goto_(format::FIRST_INSTR_ADDR_LOCATION);
+	program.goto_(*reinterpret_cast<word_t*>(program.ip));
+	while (program.ip >= program.start && program.ip < program.end) {
+		const int loc = static_cast<int>(program.ip - program.start);
+		program.jumpTarget(loc);
+
+		opcode_t opcode = 0;
+		program.read<opcode_t>(&opcode);
+		if (opcode >= GLOBAL_BREAK) break;
+
+		for (const int& arg : args[opcode]) {
+			switch (static_cast<ArgType>(arg)) {
+				case ArgType::ARG_WORD_REG:
+				case ArgType::ARG_BYTE_REG:
+				case ArgType::ARG_VEC_REG:
+					program.ip += sizeof(reg_t);
+					break;
+				case ArgType::ARG_WORD:
+					program.ip += sizeof(word_t);
+					break;
+				case ArgType::ARG_BYTE:
+					program.ip += sizeof(byte_t);
+					break;
+				default:
+					break;
+			}
+		}
+	}
+
+	const std::vector<Instr>& instrs = program.instrs;
+	for (const Instr& instr : instrs) {
+		if (instr.op == SPAWN || instr.op == JOIN || instr.op == YIELD) {
+			cout << IO_ERR "Green threads (" << instrName(instr.op) << " at BYTE" << instr.loc << ") need the interpreter, and can't be translated" IO_NORM "\n";
+			return 1;
+		}
+	}
+
+	// Labels are only needed where something jumps
+	std::vector<bool> labelled(instrs.size(), false);
+	bool computed = false;
+	labelled[program.entry] = true;
+	for (const Instr& instr : instrs) {
+		if (instr.op == JMP || instr.op == JMP_Z || instr.op == JMP_NZ || instr.op == CALL) labelled[instr.target] = true;
+		if (instr.op == R_JMP || instr.op == R_JMP_Z || instr.op == R_JMP_NZ || instr.op == RET) computed = true;
+	}
+
+	// Dispatch table: the case number of the instruction at each byte offset, or 0
+	std::vector<int> dispatch(length, 0);
+	std::vector<int> cases;
+	for (int loc = 0; loc < length && computed; loc++) {
+		if (program.instrAt[loc] < 0) continue;
+		cases.push_back(program.instrAt[loc]);
+		dispatch[loc] = static_cast<int>(cases.size());
+		labelled[program.instrAt[loc]] = true;
+	}
+
+	// The body first, so the translator knows which registers to declare
+	std::ostringstream body;
+	Translator translator(program, wordReg, byteReg, vecReg, body);
+	for (size_t i = 0; i < instrs.size(); i++) {
+		if (labelled[i]) body << translator.label(static_cast<int>(i)) << ":\n";
+		body << "\t/* " << instrs[i].loc << ": " << instrName(instrs[i].op) << " */ ";
+		translator.statement(i);
+		body << "\n";
+	}
+
+	// The host only backs the pages the stack touches, which is all growing on demand does in the VM
+	const unsigned int stackSize = std::max(execSettings.stackSize, execSettings.stackLimit);
+
+	outputFile << "/* Translated ahead of time from Z bytecode; behaves like -exec with a stack of up to " << stackSize << " bytes */\n";
+	outputFile << "/* Build it for a 64-bit host, e.g. cc -O2 out.c */\n";
+	outputFile << prelude;
+
+	outputFile << "#define LENGTH " << length << "\n";
+	outputFile << "#define STACK_SIZE " << stackSize << "\n\n";
+
+	// Loaded like Program does, with the filler after the end; only reachable through PP
+	const int filled = length + Program::FILLER_SIZE;
+	if (translator.wordUsed[register_::PP]) {
+		outputFile << "static const char program[" << filled << "] = {";
+		for (int i = 0; i < filled; i++) {
+			outputFile << (i % 16 == 0 ? "\n\t" : " ") << static_cast<int>(static_cast<signed char>(program.start[i])) << ",";
+		}
+		outputFile << "\n};\n\n";
+	}
+
+	if (computed) {
+		outputFile << "static const int dispatch[LENGTH] = {";
+		for (int loc = 0; loc < length; loc++) outputFile << (loc % 16 == 0 ? "\n\t" : " ") << dispatch[loc] << ",";
+		outputFile << "\n};\n\n";
+	}
+
+	outputFile << "int main(void) {\n";
+	for (int id = 0; id < register_::COUNT; id++) {
+		if (translator.wordUsed[id]) outputFile << "\tWord w" << id << " = { 0 };\n";
+	}
+	for (int id = 0; id < register_::COUNT; id++) {
+		if (translator.byteUsed[id] && id != register_::FZ) outputFile << "\tint8_t b" << id << " = 0;\n";
+	}
+	for (int id = 0; id < register_::NUM_VECTOR_REGISTERS; id++) {
+		if (translator.vecUsed[id]) outputFile << "\tVec v" << id << " = { { 0 } };\n";
+	}
+	outputFile << "\tint8_t FZ = 0;\n";
+	if (computed) outputFile << "\tint32_t target = 0;\n";
+
+	// Same regions, at the same offsets, as exec_ gives the program and its stack
+	outputFile << "\treserve();\n";
+	outputFile << "\tconst int32_t programAt = region(" << filled << ", 1, 0);\n";
+	outputFile << "\tconst int32_t stackAt = region(STACK_SIZE, 1, 0);\n";
+	outputFile << "\tstackEnd = (uint64_t)stackAt + STACK_SIZE;\n";
+	if (translator.wordUsed[register_::PP]) outputFile << "\tmemcpy(at(programAt, 0), program, sizeof(program));\n";
+	if (translator.wordUsed[register_::BP]) outputFile << "\tw" << register_::BP << ".i = stackAt;\n";
+	if (translator.wordUsed[register_::RP]) outputFile << "\tw" << register_::RP << ".i = stackAt;\n";
+	if (translator.wordUsed[register_::PP]) outputFile << "\tw" << register_::PP << ".i = programAt;\n";
+	outputFile << "\tgoto " << translator.label(program.entry) << ";\n\n";
+
+	outputFile << body.str();
+
+	// Computed jumps outside the program halt, like Program::jumpTarget
+	if (!computed) {
+		outputFile << "\n";
+	} else {
+		outputFile << "\ndispatch_:\n";
+		outputFile << "\tif (target < 0 || target >= LENGTH) goto halt_;\n";
+		outputFile << "\tswitch (dispatch[target]) {\n";
+		for (size_t i = 0; i < cases.size(); i++) {
+			outputFile << "\t\tcase " << i + 1 << ": goto " << translator.label(cases[i]) << ";\n";
+		}
+		outputFile << "\t\tdefault: fail(target, \"Jump target is not an instruction boundary, which only the interpreter can run\");\n";
+		outputFile << "\t}\n\n";
+	}
+
+	outputFile << "halt_:\n";
+	outputFile << "\tfputs(\"\\n\\n\\n\", stdout);\n";
+	outputFile << "\treturn 0;\n";
+	outputFile << "}\n";
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "executor.h"
+
+namespace vm {
+	namespace aot {
+		// Ahead-of-time translation of bytecode to a single C file, for programs that are run often enough to be worth
+		// building natively. Every instruction reachable from the entry point (and every instruction boundary, as
+		// disassemble_ walks them) becomes a labelled C statement, static jumps become gotos, and R_JMP goes through a
+		// dispatch table from byte offset to label. The result prints exactly what exec_ would, including the error
+		// messages, and takes its stack size from the executor settings.
+		//
+		// Registers still hold 32-bit addresses, so the output needs the same memory layout as the VM: build it for a
+		// 32-bit target, or without PIE on 64-bit (e.g. "cc -O2 -no-pie out.c").
+		int translate(const char* const& bytecodePath, const char* const& outputPath, executor::ExecutorSettings& execSettings);
+		int translate_(std::iostream& bytecodeFile, std::ostream& outputFile, executor::ExecutorSettings& execSettings);
+	}
+}
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <ios>
 #include <unordered_map>
+#include <algorithm>
 
 using vm::assembler::AssemblerException;
 using std::cout;
@@ -27,8 +28,17 @@ int vm::assembler::assemble(const char* const& assemblyPath, const char* const&
 		return 1;
 	}
 
+	std::fstream symbolFile;
+	if (assemblerSettings.symbols) {
+		symbolFile.open(std::string(outputPath) + ".sym", std::ios::out | std::ios::trunc);
+		if (!symbolFile.is_open()) {
+			cout << IO_ERR "Could not open file \"" << outputPath << ".sym\"" IO_NORM IO_END;
+			return 1;
+		}
+	}
+
 	try {
-		int out = vm::assembler::assemble_(assemblyFile, outputFile, assemblerSettings, std::cout);
+		int out = vm::assembler::assemble_(assemblyFile, outputFile, assemblerSettings, std::cout, assemblerSettings.symbols ? &symbolFile : nullptr);
 		cout << IO_MAIN "Assembly finished with code: " << out << IO_NORM IO_END;
 		return out;
 	} catch (AssemblerException& e) {
@@ -43,25 +53,27 @@ int vm::assembler::assemble(const char* const& assemblyPath, const char* const&
 int vm::assembler::disassemble(const char* const& path) {
 	cout << IO_MAIN "Attempting to disassemble file \"" << path << "\" to cout\n" IO_NORM;
 
-	std::fstream file;
-	file.open(path, std::ios::in | std::ios::binary);
-
-	if (!file.is_open()) {
+	Bytecode bytecode(path);
+	if (!bytecode.opened) {
 		cout << IO_ERR "Could not open file \"" << path << "\"" IO_NORM IO_END;
 		return 1;
 	}
 
-	int out = vm::assembler::disassemble_(file, std::cout);
+	int out = vm::assembler::disassemble_(bytecode, std::cout);
 	cout << IO_MAIN "Disassembly finished with code: " << out << IO_NORM IO_END;
 
 	return out;
 }
 
 int vm::assembler::disassemble_(std::iostream& bytecodeFile, std::ostream& stream) {
+	Bytecode bytecode(bytecodeFile);
+	return disassemble_(bytecode, stream);
+}
+
+int vm::assembler::disassemble_(Bytecode& bytecode, std::ostream& stream) {
 	using namespace types;
 	using namespace opcode;
 	
-	Bytecode bytecode(bytecodeFile);
 	bytecode.goto_(format::FIRST_INSTR_ADDR_LOCATION);
 	bytecode.goto_(*reinterpret_cast<types::word_t*>(bytecode.ip));
 
@@ -71,6 +83,8 @@ int vm::assembler::disassemble_(std::iostream& bytecodeFile, std::ostream& strea
 	byte_t byte = 0;
 
 	while (bytecode.ip < bytecode.end) {
+		// Byte offsets match the locations reported by executor errors
+		stream << (bytecode.ip - bytecode.start) << ": ";
 		bytecode.read<opcode_t>(&opcode);
 		stream << strings[opcode] << " ";
 		for (const int& arg : args[opcode]) {
@@ -83,6 +97,10 @@ int vm::assembler::disassemble_(std::iostream& bytecodeFile, std::ostream& strea
 					stream << "Byte-Reg ";
 					bytecode.read<reg_t>(&rid1);
 					break;
+				case ArgType::ARG_VEC_REG:
+					stream << "Vec-Reg ";
+					bytecode.read<reg_t>(&rid1);
+					break;
 				case ArgType::ARG_WORD:
 					stream << "Word ";
 					bytecode.read<word_t>(&word);
@@ -99,7 +117,7 @@ int vm::assembler::disassemble_(std::iostream& bytecodeFile, std::ostream& strea
 	return 0;
 }
 
-int vm::assembler::assemble_(std::iostream& assemblyFile, std::iostream& outputFile, AssemblerSettings& assemblerSettings, std::ostream& stream) {
+int vm::assembler::assemble_(std::iostream& assemblyFile, std::iostream& outputFile, AssemblerSettings& assemblerSettings, std::ostream& stream, std::ostream* symbolFile) {
 	using namespace opcode;
 	using namespace types;
 
@@ -326,8 +344,18 @@ int vm::assembler::assemble_(std::iostream& assemblyFile, std::iostream& outputF
 						break;
 
 					case 6: // ARG_STR
+						// Length-prefixed strings are the length, then the same null-terminated string
+						if (opcode == GLOBAL_LSTR) {
+							word = strlen;
+							ASM_WRITE(word, word_t);
+						}
 						ASM_WRITERAW(str, strlen + 1);
 						break;
+
+					case 7: // ARG_VEC_REG
+						reg = parseVectorRegister(str, strlen, line, column);
+						ASM_WRITE(reg, reg_t);
+						break;
 				}
 
 				carg++;
@@ -369,6 +397,14 @@ int vm::assembler::assemble_(std::iostream& assemblyFile, std::iostream& outputF
 		}
 	}
 
+	if (symbolFile != nullptr) {
+		std::vector<std::pair<word_t, std::string>> symbols;
+		for (const std::pair<const std::string, Label>& pair : labels) symbols.push_back(std::make_pair(pair.second.val, pair.first));
+		std::sort(symbols.begin(), symbols.end());
+
+		for (const std::pair<word_t, std::string>& symbol : symbols) (*symbolFile) << symbol.first << " " << symbol.second << "\n";
+	}
+
 	ASM_DEBUG(IO_END);
 
 	return 0;
@@ -419,6 +455,18 @@ types::reg_t vm::assembler::parseByteRegister(char* const& str, const int& strle
 	throw AssemblerException(AssemblerException::INVALID_BYTE_REG_PARSE, line, column);
 }
 
+types::reg_t vm::assembler::parseVectorRegister(char* const& str, const int& strlen, const int& line, const int& column) {
+	if (strlen < 2 || str[0] != 'V') throw AssemblerException(AssemblerException::INVALID_VEC_REG_PARSE, line, column);
+
+	types::reg_t out = parseNumber<types::reg_t, AssemblerException::INVALID_VEC_REG_PARSE>(str + 1, strlen - 1, line, column);
+
+	if (out >= register_::NUM_VECTOR_REGISTERS || out < 0) {
+		throw AssemblerException(AssemblerException::INVALID_VEC_REG_PARSE, line, column);
+	}
+
+	return out;
+}
+
 template<typename T, vm::assembler::AssemblerException::ErrorType eType>
 T vm::assembler::parseNumber(const char* str, int strlen, const int& line, const int& column) {
 	T base = 10;
@@ -519,4 +567,10 @@ T vm::assembler::parseNumber(const char* str, int strlen, const int& line, const
 	}
 
 	return out * mul;
-}
\ No newline at end of file
+}
+
+template types::reg_t vm::assembler::parseNumber<types::reg_t, vm::assembler::AssemblerException::INVALID_WORD_REG_PARSE>(const char*, int, const int&, const int&);
+template types::reg_t vm::assembler::parseNumber<types::reg_t, vm::assembler::AssemblerException::INVALID_BYTE_REG_PARSE>(const char*, int, const int&, const int&);
+template types::reg_t vm::assembler::parseNumber<types::reg_t, vm::assembler::AssemblerException::INVALID_VEC_REG_PARSE>(const char*, int, const int&, const int&);
+template types::word_t vm::assembler::parseNumber<types::word_t, vm::assembler::AssemblerException::INVALID_WORD_PARSE>(const char*, int, const int&, const int&);
+template types::byte_t vm::assembler::parseNumber<types::byte_t, vm::assembler::AssemblerException::INVALID_BYTE_PARSE>(const char*, int, const int&, const int&);
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "vm.h"
+#include "mapping.h"
+#include <limits>
 
 namespace vm {
 	namespace assembler {
@@ -9,6 +11,7 @@ namespace vm {
 				INVALID_OPCODE_PARSE,
 				INVALID_WORD_REG_PARSE,
 				INVALID_BYTE_REG_PARSE,
+				INVALID_VEC_REG_PARSE,
 				INVALID_WORD_PARSE,
 				INVALID_BYTE_PARSE,
 				INVALID_SHORT_PARSE,
@@ -23,6 +26,7 @@ namespace vm {
 				"Invalid opcode during parsing",
 				"Invalid word register during parsing",
 				"Invalid byte register during parsing",
+				"Invalid vector register during parsing",
 				"Invalid word during parsing",
 				"Invalid byte during parsing",
 				"Invalid short during parsing",
@@ -56,12 +60,16 @@ namespace vm {
 
 		struct AssemblerSettings {
 			Flags flags;
+			bool symbols;	// Also write the symbol table to "<output>.sym"
+
+			AssemblerSettings() : symbols(false) {}
 		};
 
 		constexpr int MAX_STR_SIZE = 256;
 
 		int assemble(const char* const& assemblyPath, const char* const& outputPath, AssemblerSettings& assemblerSettings);
-		int assemble_(std::iostream& assemblyFile, std::iostream& outputFile, AssemblerSettings& assemblerSettings, std::ostream& stream);
+		// symbolFile gets one "address name" line per label and global, or nullptr to skip
+		int assemble_(std::iostream& assemblyFile, std::iostream& outputFile, AssemblerSettings& assemblerSettings, std::ostream& stream, std::ostream* symbolFile);
 		
 		//
 		
@@ -74,25 +82,29 @@ namespace vm {
 			char* ip;
 			char* end;
 
-			Bytecode(std::iostream& program) {
-				// https://stackoverflow.com/questions/22984956/tellg-function-give-wrong-size-of-file
-				program.seekg(0, std::ios::beg);
-				program.ignore(std::numeric_limits<std::streamsize>::max());
-				std::streamsize length = program.gcount();
-
-				start = new char[length + FILLER_SIZE];
-				ip = start;
-				end = start + length;
+			bool opened;
 
-				program.clear();
-				program.seekg(0, std::ios::beg);
-				program.read(start, length);
+			Bytecode(std::iostream& program) : opened(true), owner(true) {
+				load(program);
+			}
 
-				std::fill(start + length, start + length + FILLER_SIZE, charFiller);
+			// Mapped where the platform allows, like Program
+			Bytecode(const char* path) : opened(true), owner(true) {
+				if (mapping.map(path, FILLER_SIZE)) {
+					owner = false;
+					start = mapping.start;
+					ip = start;
+					end = start + mapping.length;
+				} else {
+					std::fstream file;
+					file.open(path, std::ios::in | std::ios::binary);
+					opened = file.is_open();
+					load(file);
+				}
 			}
 
 			~Bytecode() {
-				delete[] start;
+				if (owner) delete[] start;
 			}
 
 			void goto_(types::word_t loc) {
@@ -104,23 +116,47 @@ namespace vm {
 				(*val) = *reinterpret_cast<T*>(ip);
 				ip += sizeof(T);
 			}
+
+		private:
+			bool owner;
+			MappedFile mapping;
+
+			void load(std::iostream& program) {
+				// https://stackoverflow.com/questions/22984956/tellg-function-give-wrong-size-of-file
+				program.seekg(0, std::ios::beg);
+				program.ignore(std::numeric_limits<std::streamsize>::max());
+				std::streamsize length = program.gcount();
+
+				start = new char[length + FILLER_SIZE];
+				ip = start;
+				end = start + length;
+
+				program.clear();
+				program.seekg(0, std::ios::beg);
+				program.read(start, length);
+
+				std::fill(start + length, start + length + FILLER_SIZE, charFiller);
+			}
 		};
 		
 		int disassemble(const char* const& bytecodePath);
 		int disassemble_(std::iostream& bytecodeFile, std::ostream& stream);
+		int disassemble_(Bytecode& bytecode, std::ostream& stream);
 
 		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
 		// Parsing
 
 		types::reg_t parseWordRegister(char* const& str, const int& strlen, const int& line, const int& column);
 		types::reg_t parseByteRegister(char* const& str, const int& strlen, const int& line, const int& column);
+		types::reg_t parseVectorRegister(char* const& str, const int& strlen, const int& line, const int& column);
 		template<typename T, AssemblerException::ErrorType eType>
 		T parseNumber(const char* str, int strlen, const int& line, const int& column);
 
-		// Declare for number types
-		template types::reg_t parseNumber<types::reg_t, AssemblerException::INVALID_WORD_REG_PARSE>(const char*, int, const int&, const int&);
-		template types::reg_t parseNumber<types::reg_t, AssemblerException::INVALID_BYTE_REG_PARSE>(const char*, int, const int&, const int&);
-		template types::word_t parseNumber<types::word_t, AssemblerException::INVALID_WORD_PARSE>(const char*, int, const int&, const int&);
-		template types::byte_t parseNumber<types::byte_t, AssemblerException::INVALID_BYTE_PARSE>(const char*, int, const int&, const int&);
+		// Declare for number types, instantiated in assembler.cpp
+		extern template types::reg_t parseNumber<types::reg_t, AssemblerException::INVALID_WORD_REG_PARSE>(const char*, int, const int&, const int&);
+		extern template types::reg_t parseNumber<types::reg_t, AssemblerException::INVALID_BYTE_REG_PARSE>(const char*, int, const int&, const int&);
+		extern template types::reg_t parseNumber<types::reg_t, AssemblerException::INVALID_VEC_REG_PARSE>(const char*, int, const int&, const int&);
+		extern template types::word_t parseNumber<types::word_t, AssemblerException::INVALID_WORD_PARSE>(const char*, int, const int&, const int&);
+		extern template types::byte_t parseNumber<types::byte_t, AssemblerException::INVALID_BYTE_PARSE>(const char*, int, const int&, const int&);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+using std::cout;
+
+namespace {
+	using namespace vm::executor;
+
+	struct Job {
+		std::string path;
+		std::string inputPath;	// Empty for no input
+
+		std::string output;
+		int code;
+		double seconds;
+		uint64_t retired;
+	};
+
+	// Same handling as exec, but into the job's own buffer
+	void runJob(Job& job, const ExecutorSettings& batchSettings, bool counting) {
+		ExecutorSettings execSettings = batchSettings;
+		execSettings.retiredOut = counting ? &job.retired : nullptr;
+
+		std::ostringstream out;
+		const auto start = std::chrono::steady_clock::now();
+
+		std::fstream input;
+		if (!job.inputPath.empty()) input.open(job.inputPath, std::ios::in);
+		std::istringstream noInput;
+
+		try {
+			Program program(job.path.c_str());
+			if (!program.opened) {
+				out << IO_ERR "Could not open file \"" << job.path << "\"" IO_NORM IO_END;
+				job.code = 1;
+			} else if (!job.inputPath.empty() && !input.is_open()) {
+				out << IO_ERR "Could not open input file \"" << job.inputPath << "\"" IO_NORM IO_END;
+				job.code = 1;
+			} else {
+				job.code = exec_(program, execSettings, out, job.inputPath.empty() ? static_cast<std::istream&>(noInput) : input, nullptr);
+			}
+		} catch (ExecutorException& e) {
+			out << IO_ERR "Error during execution at BYTE" << e.loc << " : " << e.what() << IO_NORM IO_END;
+			job.code = 1;
+		} catch (std::exception& e) {
+			out << IO_ERR "An unknown error ocurred during execution. This error is most likely an issue with the c++ executor code, not your code. Sorry. The provided error message is as follows:\n" << e.what() << IO_NORM IO_END;
+			job.code = 1;
+		}
+
+		job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		job.output = out.str();
+	}
+
+	// Nearest-rank percentile of sorted values
+	double percentile(const std::vector<double>& sorted, double p) {
+		size_t rank = static_cast<size_t>(p / 100.0 * sorted.size() + 0.999999);
+		rank = std::max<size_t>(rank, 1);
+		return sorted[std::min(rank, sorted.size()) - 1];
+	}
+}
+
+int vm::executor::execBatch(const char* const& manifestPath, ExecutorSettings& execSettings) {
+	cout << IO_MAIN "Attempting to execute batch \"" << manifestPath << "\"\n" IO_NORM;
+
+	std::fstream manifest;
+	manifest.open(manifestPath, std::ios::in);
+	if (!manifest.is_open()) {
+		cout << IO_ERR "Could not open file \"" << manifestPath << "\"" IO_NORM IO_END;
+		return 1;
+	}
+
+	std::vector<Job> jobs;
+	std::string line;
+	while (std::getline(manifest, line)) {
+		std::istringstream fields(line);
+		Job job = {};
+		if (!(fields >> job.path) || job.path[0] == '#') continue;
+		fields >> job.inputPath;
+		jobs.push_back(job);
+	}
+
+	if (jobs.empty()) {
+		cout << IO_WARN "No jobs in batch" IO_NORM IO_END;
+		return 0;
+	}
+
+	ExecutorSettings batchSettings = execSettings;
+	if (batchSettings.samplePath != nullptr || batchSettings.profilePath != nullptr) {
+		cout << IO_WARN "Sampling and profile output files are ignored in batches" IO_NORM "\n";
+		batchSettings.samplePath = nullptr;
+		batchSettings.profilePath = nullptr;
+	}
+	if (batchSettings.snapshotLabel != nullptr) {
+		cout << IO_WARN "Snapshots are not taken in batches" IO_NORM "\n";
+		batchSettings.snapshotLabel = nullptr;
+	}
+	// Counting keeps jobs interpreted, so there's no instruction count with the JIT
+	const bool counting = !batchSettings.jit;
+
+	unsigned int threads = batchSettings.threads > 0 ? batchSettings.threads : std::thread::hardware_concurrency();
+	threads = std::max(1u, std::min(threads, static_cast<unsigned int>(jobs.size())));
+
+	// Workers take the next job until there are none left
+	std::atomic<size_t> nextJob(0);
+	auto worker = [&]() {
+		for (size_t i = nextJob++; i < jobs.size(); i = nextJob++) runJob(jobs[i], batchSettings, counting);
+	};
+
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> pool;
+	for (unsigned int i = 1; i < threads; i++) pool.push_back(std::thread(worker));
+	worker();
+	for (std::thread& thread : pool) thread.join();
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	int failed = 0;
+	uint64_t retired = 0;
+	std::vector<double> latencies;
+	for (size_t i = 0; i < jobs.size(); i++) {
+		const Job& job = jobs[i];
+		cout << IO_MAIN "Job " << i + 1 << " \"" << job.path << "\" finished with code: " << job.code
+			<< " (" << std::fixed << std::setprecision(3) << job.seconds * 1000 << " ms)\n" IO_NORM;
+		cout << job.output;
+
+		if (job.code != 0) failed++;
+		retired += job.retired;
+		latencies.push_back(job.seconds * 1000);
+	}
+	std::sort(latencies.begin(), latencies.end());
+
+	cout << IO_MAIN "Batch finished: " << jobs.size() << " jobs (" << failed << " failed) on " << threads << " threads in " << seconds << " s\n";
+	cout << "[MAIN] Throughput: " << std::setprecision(1) << jobs.size() / seconds << " jobs/sec";
+	if (counting) cout << ", " << std::setprecision(0) << retired / seconds << " instructions/sec (" << retired << " retired)";
+	cout << "\n";
+	cout << "[MAIN] Job latency (ms): p50 " << std::setprecision(3) << percentile(latencies, 50) << ", p90 " << percentile(latencies, 90)
+		<< ", p99 " << percentile(latencies, 99) << ", max " << latencies.back() << IO_NORM IO_END;
+	cout << std::defaultfloat << std::setprecision(6);
+
+	return failed > 0 ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "executor.h"
+
+namespace vm {
+	namespace executor {
+		// Runs every program listed in a manifest on a pool of worker threads
+		// Each line of the manifest is a bytecode path, optionally followed by a file to use as that program's input;
+		// blank lines and lines starting with '#' are skipped. Jobs get their own Program, Stack and Machine, write to
+		// their own buffer instead of std::cout, and read from their input file (or nothing). Once every job has
+		// finished, their output is printed in manifest order, followed by throughput and latency percentiles.
+		// Sampling and -profileout are process-wide, so they're ignored here.
+		int execBatch(const char* const& manifestPath, ExecutorSettings& execSettings);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,257 @@
+#include "executor.h"
+
+#include <chrono>
+#include <functional>
+#include <iterator>
+
+using vm::executor::Instr;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// On-disk cache of decoded programs
+//
+// Entries are named by a hash of the program's bytes and whether it was fused, and hold decode()'s output with every
+// register operand stored as a register ID, since the pointers only mean something for one Machine. Loading an entry
+// is a single pass over it to point those IDs at the new registers, instead of walking the bytecode.
+// That goes for verification too: an entry records whether the program passed it, and one that did is trusted as is.
+//
+// Every entry also records the build it came from: a hash of the opcode table, the fusion table and the times the
+// decoder, the engines, the verifier and this file were compiled, since rebuilding any one of them can change what an
+// entry should hold. An entry from any other build is ignored and then overwritten, so a cache directory can be shared
+// between builds without ever being cleared by hand.
+
+namespace {
+	constexpr char MAGIC[4] = { 'Z', 'D', 'C', '1' };
+	constexpr uint8_t REG_NONE = 0xff;
+	constexpr uint8_t REG_BYTE = 0x80;	// Set for byte registers, with the ID in the low bits
+	constexpr uint8_t REG_VEC = 0x40;	// Same, for vector registers
+	constexpr uint8_t REG_ID = 0x3f;
+
+	struct Header {
+		char magic[4];
+		uint32_t fused;
+		uint64_t build;
+		uint64_t content;
+		int32_t length;		// Of the bytecode
+		int32_t entry;
+		int32_t haltIndex;
+		int32_t count;		// Of instrs, which follow instrAt
+		uint32_t verified;	// Whether Program::verify passed, so a hit doesn't need to run it again
+	};
+
+	struct CachedInstr {
+		int32_t imm;
+		int32_t target;
+		int32_t loc;
+		uint16_t op;
+		uint8_t reg[3];		// Operands a, b and c
+		uint8_t pad;
+	};
+
+	// FNV-1a
+	uint64_t hash(uint64_t h, const void* data, size_t size) {
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++) {
+			h ^= bytes[i];
+			h *= 0x100000001b3ull;
+		}
+		return h;
+	}
+
+	uint64_t hashString(uint64_t h, const char* str) {
+		return hash(h, str, std::strlen(str) + 1);
+	}
+
+	// Anything that changes what decode() produces changes this
+	uint64_t buildHash() {
+		using namespace vm;
+
+		static const uint64_t build = [] {
+			uint64_t h = 0xcbf29ce484222325ull;
+			h = hashString(h, __DATE__ " " __TIME__);
+			h = hashString(h, executor::Program::decoderBuilt);
+			h = hashString(h, executor::Program::executorBuilt);
+			h = hashString(h, executor::Program::verifierBuilt);
+
+			for (int op = 0; op < opcode::count; op++) {
+				h = hashString(h, opcode::strings[op]);
+				for (const int& arg : opcode::args[op]) h = hash(h, &arg, sizeof(arg));
+			}
+
+#define FUSION_HASH(op, ...) h = hashString(h, #op #__VA_ARGS__);
+			EXEC_FUSIONS(FUSION_HASH)
+#undef FUSION_HASH
+#define NO_FLAGS_HASH(op) h = hashString(h, #op);
+			EXEC_NO_FLAGS(NO_FLAGS_HASH)
+#undef NO_FLAGS_HASH
+
+			const int sizes[] = { register_::COUNT, register_::NUM_VECTOR_REGISTERS, executor::Program::FILLER_SIZE, static_cast<int>(sizeof(Header)), static_cast<int>(sizeof(CachedInstr)) };
+			return hash(h, sizes, sizeof(sizes));
+		}();
+
+		return build;
+	}
+
+	uint8_t packOperand(const vm::executor::Operand& operand, const types::WordVal* wordReg, const types::ByteVal* byteReg, const types::VecVal* vecReg) {
+		using namespace vm;
+
+		const std::less<const void*> before;
+		if (operand.word == nullptr) return REG_NONE;
+		if (!before(operand.word, wordReg) && before(operand.word, wordReg + register_::COUNT)) return static_cast<uint8_t>(operand.word - wordReg);
+		if (!before(operand.vec, vecReg) && before(operand.vec, vecReg + register_::NUM_VECTOR_REGISTERS)) return static_cast<uint8_t>((operand.vec - vecReg) | REG_VEC);
+		return static_cast<uint8_t>((operand.byte - byteReg) | REG_BYTE);
+	}
+}
+
+void vm::executor::Program::decode(types::WordVal* wordRegIn, types::ByteVal* byteRegIn, types::VecVal* vecRegIn, bool fuse, const char* cacheDir, bool verify) {
+	const uint64_t content = hash(0xcbf29ce484222325ull, start, end - start);
+
+	char name[64];
+	std::snprintf(name, sizeof(name), "/%016llx%s.zdc", static_cast<unsigned long long>(content), fuse ? "f" : "");
+	const std::string path = std::string(cacheDir) + name;
+
+	if (loadDecoded(path, content, wordRegIn, byteRegIn, vecRegIn, fuse, verify)) return;
+
+	if (verify) this->verify();
+	decode(wordRegIn, byteRegIn, vecRegIn, fuse);
+	storeDecoded(path, content);
+}
+
+// Leaves the program as it was unless the whole entry checks out
+bool vm::executor::Program::loadDecoded(const std::string& path, uint64_t content, types::WordVal* wordRegIn, types::ByteVal* byteRegIn, types::VecVal* vecRegIn, bool fuse, bool verify) {
+	const int length = static_cast<int>(end - start);
+
+	MappedFile file;
+	std::vector<char> read;
+	const char* data;
+	size_t size;
+	if (file.map(path.c_str(), 0)) {
+		data = file.start;
+		size = file.length;
+	} else {
+		std::fstream stream;
+		stream.open(path, std::ios::in | std::ios::binary);
+		if (!stream.is_open()) return false;
+		read.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+		data = read.data();
+		size = read.size();
+	}
+
+	if (size < sizeof(Header)) return false;
+	Header header;
+	std::memcpy(&header, data, sizeof(header));
+
+	if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.fused != static_cast<uint32_t>(fuse) || header.build != buildHash() ||
+		header.content != content || header.length != length || (verify && !header.verified)) return false;
+
+	const int count = header.count;
+	if (count <= 0 || count > 2 * length + 1 || header.entry < 0 || header.entry >= count || header.haltIndex < 0 || header.haltIndex >= count) return false;
+	if (size != sizeof(Header) + length * sizeof(int32_t) + count * sizeof(CachedInstr)) return false;
+
+	const char* at = data + sizeof(Header);
+	std::vector<int> instrAtIn(length);
+	std::memcpy(instrAtIn.data(), at, length * sizeof(int32_t));
+	at += length * sizeof(int32_t);
+	for (const int& index : instrAtIn) {
+		if (index < -1 || index >= count) return false;
+	}
+
+	std::vector<Instr> instrsIn;
+	instrsIn.reserve(2 * static_cast<size_t>(length) + 1);
+	for (int i = 0; i < count; i++, at += sizeof(CachedInstr)) {
+		CachedInstr cached;
+		std::memcpy(&cached, at, sizeof(cached));
+		if (cached.op >= execop::COUNT || cached.target < 0 || cached.target >= count) return false;
+
+		Instr instr = {};
+		instr.imm = cached.imm;
+		instr.target = cached.target;
+		instr.loc = cached.loc;
+		instr.op = cached.op;
+
+		Operand* operand = &instr.a;
+		for (const uint8_t& reg : cached.reg) {
+			const int rid = reg & REG_ID;
+			if (reg != REG_NONE) {
+				if (rid >= register_::COUNT || ((reg & REG_VEC) && rid >= register_::NUM_VECTOR_REGISTERS)) return false;
+				if (reg & REG_BYTE) {
+					operand->byte = byteRegIn + rid;
+				} else if (reg & REG_VEC) {
+					operand->vec = vecRegIn + rid;
+				} else {
+					operand->word = wordRegIn + rid;
+				}
+			}
+			operand++;
+		}
+
+		instrsIn.push_back(instr);
+	}
+
+	wordReg = wordRegIn;
+	byteReg = byteRegIn;
+	vecReg = vecRegIn;
+	fusing = fuse;
+	verified = header.verified != 0;
+	instrs.swap(instrsIn);
+	instrAt.swap(instrAtIn);
+	entry = header.entry;
+	haltIndex = header.haltIndex;
+	return true;
+}
+
+// Best effort: a cache that can't be written to just means decoding again next time
+// Written under a temporary name first, so a concurrent run never reads half an entry
+void vm::executor::Program::storeDecoded(const std::string& path, uint64_t content) {
+	const int length = static_cast<int>(end - start);
+
+	Header header = {};
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.fused = fusing;
+	header.build = buildHash();
+	header.content = content;
+	header.length = length;
+	header.entry = entry;
+	header.haltIndex = haltIndex;
+	header.count = static_cast<int32_t>(instrs.size());
+	header.verified = verified;
+
+	std::vector<char> data(sizeof(Header) + length * sizeof(int32_t) + instrs.size() * sizeof(CachedInstr));
+	char* at = data.data();
+	std::memcpy(at, &header, sizeof(header));
+	at += sizeof(header);
+	std::memcpy(at, instrAt.data(), length * sizeof(int32_t));
+	at += length * sizeof(int32_t);
+
+	for (const Instr& instr : instrs) {
+		CachedInstr cached = {};
+		cached.imm = instr.imm;
+		cached.target = instr.target;
+		cached.loc = instr.loc;
+		cached.op = instr.op;
+		cached.reg[0] = packOperand(instr.a, wordReg, byteReg, vecReg);
+		cached.reg[1] = packOperand(instr.b, wordReg, byteReg, vecReg);
+		cached.reg[2] = packOperand(instr.c, wordReg, byteReg, vecReg);
+		std::memcpy(at, &cached, sizeof(cached));
+		at += sizeof(cached);
+	}
+
+	const std::string temp = path + "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + "." +
+		std::to_string(reinterpret_cast<uintptr_t>(this)) + ".tmp";
+	{
+		std::fstream file;
+		file.open(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) return;
+		file.write(data.data(), data.size());
+		if (!file) {
+			file.close();
+			std::remove(temp.c_str());
+			return;
+		}
+	}
+
+	// std::rename doesn't replace an existing file everywhere, so an entry from another build may need removing first
+	if (std::rename(temp.c_str(), path.c_str()) != 0) {
+		std::remove(path.c_str());
+		if (std::rename(temp.c_str(), path.c_str()) != 0) std::remove(temp.c_str());
+	}
+}
\ No newline at end of file
@@ -0,0 +1,321 @@
+#include "executor.h"
+
+using vm::executor::Instr;
+
+const char* const vm::executor::Program::decoderBuilt = __DATE__ " " __TIME__;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Load-time decoding of the bytecode into Program::instrs
+//
+// Every byte offset is decoded at most once, and every run adds at most one extra instruction (the HALT or jump that
+// ends it), so instrs never holds more than 2 * length + 1 entries. Reserving that up front means runs decoded during
+// execution never move the instructions the engines are pointing at.
+
+void vm::executor::Program::decode(types::WordVal* wordRegIn, types::ByteVal* byteRegIn, types::VecVal* vecRegIn, bool fuse) {
+	using namespace types;
+
+	const int length = static_cast<int>(end - start);
+	wordReg = wordRegIn;
+	byteReg = byteRegIn;
+	vecReg = vecRegIn;
+	fusing = fuse;
+
+	instrs.clear();
+	instrs.reserve(2 * static_cast<size_t>(length) + 1);
+	instrAt.assign(length, -1);
+
+	// Jumps outside of the program all land here
+	Instr halt = {};
+	halt.op = opcode::HALT;
+	halt.loc = length;
+	haltIndex = static_cast<int>(instrs.size());
+	instrs.push_back(halt);
+
+	goto_(format::FIRST_INSTR_ADDR_LOCATION);
+	word_t first = *reinterpret_cast<word_t*>(ip);
+	// Verification walked everything decoded from here, so none of it needs checking again
+	entry = first < 0 || first >= length ? haltIndex : decodeFrom(first, verified);
+}
+
+void vm::executor::Program::link(const HandlerRef* handlersIn) {
+	handlers = handlersIn;
+	for (Instr& instr : instrs) instr.handler = handlers[instr.op];
+}
+
+void vm::executor::Program::setOp(const Instr* instr, uint16_t op) {
+	Instr& target = instrs[instr - instrs.data()];
+	target.op = op;
+	if (handlers != nullptr) target.handler = handlers[op];
+}
+
+// Decodes the run at loc, then every static jump target it (and the runs after it) can reach
+// verifiedRun says Program::verify walked the run and its targets, which is only known for the first instruction
+int vm::executor::Program::decodeFrom(int loc, bool verifiedRun) {
+	using namespace opcode;
+
+	const int length = static_cast<int>(end - start);
+	const size_t firstNew = instrs.size();
+	const int out = verifiedRun ? decodeRun<true>(loc) : decodeRun<false>(loc);
+
+	for (size_t i = firstNew; i < instrs.size(); i++) {
+		Instr& instr = instrs[i];
+		if (instr.op != JMP && instr.op != JMP_Z && instr.op != JMP_NZ && instr.op != CALL) continue;
+		if (instr.loc >= length || instrAt[instr.loc] != static_cast<int>(i)) continue; // Run terminator, already resolved
+
+		// CALL keeps its location in target, since imm holds the frame size
+		const types::word_t to = instr.op == CALL ? instr.target : instr.imm;
+		if (to < 0 || to >= length) {
+			instr.target = haltIndex;
+		} else {
+			if (instrAt[to] < 0) verifiedRun ? decodeRun<true>(to) : decodeRun<false>(to);
+			instrs[i].target = instrAt[to];
+		}
+	}
+
+	if (fusing) {
+		elideFlags(firstNew);
+		fuse(firstNew);
+	}
+
+	if (handlers != nullptr) {
+		for (size_t i = firstNew; i < instrs.size(); i++) instrs[i].handler = handlers[instrs[i].op];
+	}
+
+	return out;
+}
+
+// Decodes straight-line from loc until reaching something already decoded, an unknown opcode, or the end
+// Same walk as vm::assembler::disassemble_. Verified runs skip the opcode and register checks.
+template<bool Verified>
+int vm::executor::Program::decodeRun(int loc) {
+	using namespace types;
+	using namespace opcode;
+
+	const int length = static_cast<int>(end - start);
+	const int out = static_cast<int>(instrs.size());
+
+	opcode_t opcode = 0;
+	reg_t rid = 0;
+	word_t word = 0;
+	byte_t byte = 0;
+
+	goto_(loc);
+	while (true) {
+		loc = static_cast<int>(ip - start);
+
+		if (loc >= length) {
+			Instr halt = {};
+			halt.op = HALT;
+			halt.loc = loc;
+			instrs.push_back(halt);
+			break;
+		}
+
+		if (instrAt[loc] >= 0) {
+			// Continue into the run that already covers this offset
+			Instr jump = {};
+			jump.op = JMP;
+			jump.imm = loc;
+			jump.target = instrAt[loc];
+			jump.loc = loc;
+			instrs.push_back(jump);
+			break;
+		}
+
+		Instr instr = {};
+		instr.loc = loc;
+		instrAt[loc] = static_cast<int>(instrs.size());
+
+		read<opcode_t>(&opcode);
+		instr.op = opcode;
+
+		if (!Verified && opcode >= GLOBAL_BREAK) {
+			// Length unknown past this point
+			instr.op = execop::BAD_OPCODE;
+			instrs.push_back(instr);
+			break;
+		}
+
+		Operand* operand = &instr.a;
+		int words = 0;
+		for (const int& arg : args[opcode]) {
+			switch (static_cast<ArgType>(arg)) {
+				case ArgType::ARG_WORD_REG:
+				case ArgType::ARG_BYTE_REG:
+					read<reg_t>(&rid);
+					if (!Verified && rid >= register_::COUNT) {
+						instr.op = execop::BAD_REGISTER;
+					} else if (static_cast<ArgType>(arg) == ArgType::ARG_WORD_REG) {
+						operand->word = wordReg + rid;
+					} else {
+						operand->byte = byteReg + rid;
+					}
+					operand++;
+					break;
+
+				case ArgType::ARG_VEC_REG:
+					read<reg_t>(&rid);
+					if (!Verified && rid >= register_::NUM_VECTOR_REGISTERS) {
+						instr.op = execop::BAD_REGISTER;
+					} else {
+						operand->vec = vecReg + rid;
+					}
+					operand++;
+					break;
+
+				case ArgType::ARG_WORD:
+					read<word_t>(&word);
+					// A second word moves the first to target, which is how CALL keeps its label for decodeFrom
+					if (words++ > 0) instr.target = instr.imm;
+					instr.imm = word;
+					break;
+
+				case ArgType::ARG_BYTE:
+					read<byte_t>(&byte);
+					instr.imm = byte;
+					break;
+
+				default:
+					break;
+			}
+		}
+
+		instrs.push_back(instr);
+	}
+
+	return out;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Superinstructions
+//
+// Only the op of the first instruction in a sequence changes. The rest keep their own records and handlers, so the
+// fused handler can run each of them in place and jumps into the middle of a sequence still work.
+
+namespace {
+	namespace execop = vm::executor::execop;
+
+	constexpr int MAX_FUSION = 4;
+
+	struct Fusion {
+		int op;
+		int ops[MAX_FUSION + 1];	// Ends in -1
+	};
+
+	constexpr Fusion fusions[] = {
+#define FUSION_ENTRY(op, ...) { vm::executor::execop::op, { __VA_ARGS__, -1 } },
+		EXEC_FUSIONS(FUSION_ENTRY)
+#undef FUSION_ENTRY
+	};
+
+	// Each op's variant that leaves FZ alone, and the op each variant stands for; ops without one map to themselves
+	struct FlagVariants {
+		uint16_t noFlags[vm::executor::execop::COUNT];
+		uint16_t flags[vm::executor::execop::COUNT];
+
+		constexpr FlagVariants() : noFlags(), flags() {
+			for (int op = 0; op < vm::executor::execop::COUNT; op++) noFlags[op] = flags[op] = static_cast<uint16_t>(op);
+#define NO_FLAGS_ENTRY(op) noFlags[opcode::op] = vm::executor::execop::op##_NF; flags[vm::executor::execop::op##_NF] = opcode::op;
+			EXEC_NO_FLAGS(NO_FLAGS_ENTRY)
+#undef NO_FLAGS_ENTRY
+		}
+	};
+
+	constexpr FlagVariants variants;
+
+	// An op matches itself, and an opcode its variant that leaves FZ alone, which the fused handler then runs with flags
+	bool matches(int fusionOp, int op) {
+		return fusionOp == op || fusionOp == variants.flags[op];
+	}
+}
+
+void vm::executor::Program::fuse(size_t from) {
+	// Going forwards, the instructions after i still hold their original ops when i is matched
+	for (size_t i = from; i < instrs.size(); i++) {
+		for (const Fusion& fusion : fusions) {
+			size_t n = 0;
+			while (fusion.ops[n] >= 0 && i + n < instrs.size() && matches(fusion.ops[n], instrs[i + n].op)) n++;
+
+			if (fusion.ops[n] < 0) {
+				instrs[i].op = fusion.op;
+				break;
+			}
+		}
+	}
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Flag elision
+//
+// Arithmetic sets FZ from its result, but almost none of those results are branched on. Walking each run backwards,
+// FZ is dead after an instruction when the next thing to touch it is another instruction setting it without reading
+// it first, and arithmetic that sets a dead FZ is given its variant that doesn't. Only straight-line code is looked
+// at: anything that may leave the run or does something else with FZ counts as reading it, so a flag a branch, a RET
+// or another thread could see is always set. Jumps into the middle of a run are fine, since whether FZ is read after
+// an instruction only depends on what comes after it.
+
+namespace {
+	enum class FlagUse {
+		NONE,	// Falls through without touching FZ
+		SETS,	// Falls through after setting FZ, without reading it
+		READS	// Anything else
+	};
+
+	FlagUse flagUse(const Instr& instr, const types::ByteVal* fz) {
+		using namespace opcode;
+
+		if (instr.op >= opcode::count) return FlagUse::READS;
+
+		// FZ named as a byte register operand, whether read or written
+		const vm::executor::Operand* operand = &instr.a;
+		for (const int& arg : args[instr.op]) {
+			const ArgType type = static_cast<ArgType>(arg);
+			if (type == ArgType::ARG_BYTE_REG && operand->byte == fz) return FlagUse::READS;
+			if (type == ArgType::ARG_WORD_REG || type == ArgType::ARG_BYTE_REG || type == ArgType::ARG_VEC_REG) operand++;
+		}
+
+		switch (instr.op) {
+			case I_FLAG: case I_CMP_EQ: case I_CMP_NE: case I_CMP_GT: case I_CMP_LT: case I_CMP_GE: case I_CMP_LE:
+			case I_INC: case I_DEC: case I_ADD: case I_SUB: case I_MUL: case I_DIV: case I_MOD:
+			case C_FLAG: case C_CMP_EQ: case C_CMP_NE: case C_CMP_GT: case C_CMP_LT: case C_CMP_GE: case C_CMP_LE:
+			case C_INC: case C_DEC: case C_ADD: case C_SUB: case C_MUL: case C_DIV: case C_MOD:
+			case F_FLAG: case F_CMP_EQ: case F_CMP_NE: case F_CMP_GT: case F_CMP_LT: case F_CMP_GE: case F_CMP_LE:
+			case F_ADD: case F_SUB: case F_MUL: case F_DIV: case F_MOD:
+			case MEM_CMP: case STR_LEN: case STR_CMP: case STR_CHR: case LSTR_CMP: case LSTR_CHR: case VI_SUM: case VF_SUM:
+				return FlagUse::SETS;
+
+			case NOP: case ALLOC: case FREE: case R_MOV_W: case R_MOV_B: case MOV_W: case MOV_B:
+			case LOAD_W: case STORE_W: case LOAD_B: case STORE_B:
+			case I_TO_C: case I_TO_F: case C_TO_I: case C_TO_F: case F_TO_C: case F_TO_I:
+			case PRNT_C: case PRNT_STR: case READ_C: case READ_STR: case R_PRNT_I: case R_PRNT_F: case PRNT_LN: case TIME: case FLUSH:
+			case MEM_CPY: case MEM_MOVE: case MEM_SET: case STR_CPY: case LSTR_CPY:
+			case V_LOAD: case V_STORE: case V_SPLAT: case VI_ADD: case VI_SUB: case VI_MUL: case VI_DIV: case VI_MIN: case VI_MAX:
+			case VF_ADD: case VF_SUB: case VF_MUL: case VF_DIV: case VF_MIN: case VF_MAX:
+				return FlagUse::NONE;
+
+			default:
+				return FlagUse::READS;
+		}
+	}
+}
+
+void vm::executor::Program::elideFlags(size_t from) {
+	const types::ByteVal* fz = byteReg + register_::FZ;
+
+	// Every run ends in a HALT or jump, which reads, so the last instruction decoded needs no special case
+	bool live = true;
+	for (size_t i = instrs.size(); i-- > from;) {
+		Instr& instr = instrs[i];
+		switch (flagUse(instr, fz)) {
+			case FlagUse::SETS:
+				if (!live) instr.op = variants.noFlags[instr.op];
+				live = false;
+				break;
+			case FlagUse::READS:
+				live = true;
+				break;
+			default:
+				break;
+		}
+	}
+}
\ No newline at end of file
@@ -1,20 +1,33 @@
-#include "executor.h"
-#include <limits>
-#include <math.h>
+#include "executorops.h"
+#include "profiler.h"
+#include "sampler.h"
+#include "jit.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <array>
+#include <initializer_list>
+#include <type_traits>
+#include <utility>
 
 using std::cout;
 
-#define AS_WORD(x) \
-	reinterpret_cast<types::word_t*>(x)
+const char* const vm::executor::Program::executorBuilt = __DATE__ " " __TIME__;
 
 int vm::executor::exec(const char* const& path, ExecutorSettings& execSettings) {
 	cout << IO_MAIN "Attempting to execute file \"" << path << "\"\n" IO_NORM;
 
-	std::fstream file;
-	file.open(path, std::ios::in | std::ios::binary);
+	// Symbols written alongside the program by the assembler, for the profiler and -snapshotat
+	std::fstream symbolFile;
+	if (execSettings.flags.hasFlags(FLAG_PROFILE) || execSettings.samplePath != nullptr || execSettings.snapshotLabel != nullptr) symbolFile.open(std::string(path) + ".sym", std::ios::in);
 
 	try {
-		int out = vm::executor::exec_(file, execSettings, std::cout, std::cin);
+		Program program(path);
+		if (!program.opened) {
+			cout << IO_ERR "Could not open file \"" << path << "\"" IO_NORM IO_END;
+			return 1;
+		}
+
+		int out = vm::executor::exec_(program, execSettings, std::cout, std::cin, symbolFile.is_open() ? &symbolFile : nullptr);
 		cout << IO_MAIN "Execution finished with code: " << out << IO_NORM IO_END;
 		return out;
 	} catch (ExecutorException& e) {
@@ -26,527 +39,427 @@ int vm::executor::exec(const char* const& path, ExecutorSettings& execSettings)
 	return 1;
 }
 
-int vm::executor::exec_(std::iostream& file, ExecutorSettings& execSettings, std::ostream& streamOut, std::istream& streamIn) {
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Dispatch engines
+
+namespace {
+	using namespace vm::executor;
 	using namespace types;
 	using namespace opcode;
+	using namespace execop;
 
-	Program program(file);
-	Stack stack(execSettings.stackSize);
-	WordVal wordReg[register_::COUNT];
-	ByteVal byteReg[register_::COUNT];
-	wordReg[register_::BP].word = reinterpret_cast<word_t>(stack.start);
-	wordReg[register_::RP].word = reinterpret_cast<word_t>(stack.start);
-	wordReg[register_::PP].word = reinterpret_cast<word_t>(program.start);
-	byteReg[register_::FZ].bool_ = 0;
-
-	program.goto_(format::FIRST_INSTR_ADDR_LOCATION);
-	program.goto_(*AS_WORD(program.ip));
-
-	// Dummy values
-	opcode_t opcode = 0;
-	reg_t rid1 = 0;
-	reg_t rid2 = 0;
-	reg_t rid3 = 0;
-	word_t word = 0;
-	byte_t byte = 0;
-	int_t int_ = 0;
-	char_t char_ = 0;
-	float_t float_ = 0;
-	char rlchar = 0;
-	
-	// stupid workaround for stupid stupidness
-	const char* strThingForDebugging;
-
-	while (program.ip < program.end) {
-		program.read<opcode_t>(&opcode);
-		strThingForDebugging = opcode::strings[opcode];
-		switch (opcode) {
-			case NOP:
-				break;
-
-			case HALT:
-				goto end;
-				return 0;
-
-			case BREAK:
-				while (streamIn.get() != '\n');
-				break;
-
-			case ALLOC: // TODO : Careful with the memory!
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				try {
-					wordReg[rid1].word = reinterpret_cast<word_t>(new char[wordReg[rid2].word]);
-				} catch (std::bad_alloc& e) {
-					throw ExecutorException(ExecutorException::BAD_ALLOC, program.ip - program.start, e.what());
-				}
-				break;
-
-			case FREE:
-				program.read<reg_t>(&rid1);
-				delete[] reinterpret_cast<char*>(wordReg[rid1].word);
-				break;
-
-			case R_MOV_W:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				wordReg[rid1] = wordReg[rid2];
-				break;
-
-			case R_MOV_B:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[rid1] = byteReg[rid2];
-				break;
-
-			case MOV_W:
-				program.read<reg_t>(&rid1);
-				program.read<word_t>(&word);
-				wordReg[rid1].word = word;
-				break;
-
-			case MOV_B:
-				program.read<reg_t>(&rid1);
-				program.read<byte_t>(&byte);
-				byteReg[rid1].byte = byte;
-				break;
-
-			case LOAD_W:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<word_t>(&word);
-				wordReg[rid1].word = *reinterpret_cast<word_t*>(wordReg[rid2].word + word);
-				break;
-
-			case STORE_W:
-				program.read<reg_t>(&rid1);
-				program.read<word_t>(&word);
-				program.read<reg_t>(&rid2);
-				*reinterpret_cast<word_t*>(wordReg[rid1].word + word) = wordReg[rid2].word;
-				break;
-
-			case LOAD_B:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<word_t>(&word);
-				byteReg[rid1].byte = *reinterpret_cast<byte_t*>(wordReg[rid2].word + word);
-				break;
-
-			case STORE_B:
-				program.read<reg_t>(&rid1);
-				program.read<word_t>(&word);
-				program.read<reg_t>(&rid2);
-				*reinterpret_cast<byte_t*>(wordReg[rid1].word + word) = byteReg[rid2].byte;
-				break;
-
-			case JMP:
-				program.read<word_t>(&word);
-				program.goto_(word);
-				break;
-
-			case JMP_Z:
-				if (byteReg[register_::FZ].bool_) {
-					program.ip += sizeof(word_t);
-				} else {
-					program.read<word_t>(&word);
-					program.goto_(word);
-				}
-				break;
-
-			case JMP_NZ:
-				if (byteReg[register_::FZ].bool_) {
-					program.read<word_t>(&word);
-					program.goto_(word);
-				} else {
-					program.ip += sizeof(word_t);
-				}
-				break;
-
-			case R_JMP:
-				program.read<reg_t>(&rid1);
-				program.goto_(wordReg[rid1].word);
-				break;
-
-			case R_JMP_Z:
-				if (byteReg[register_::FZ].bool_ == 0) {
-					program.ip += sizeof(reg_t);
-				} else {
-					program.read<reg_t>(&rid1);
-					program.goto_(wordReg[rid1].word);
-				}
-				break;
-
-			case R_JMP_NZ:
-				if (byteReg[register_::FZ].bool_ == 0) {
-					program.read<reg_t>(&rid1);
-					program.goto_(wordReg[rid1].word);
-				} else {
-					program.ip += sizeof(reg_t);
-				}
-				break;
-
-			case I_FLAG:
-				program.read<reg_t>(&rid1);
-				byteReg[register_::FZ].bool_ = wordReg[rid1].int_ == 0 ? 0 : 1;
-				// TODO : Set other flags if they exist?
-				break;
-
-			case I_CMP_EQ:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = wordReg[rid1].int_ == wordReg[rid2].int_ ? 1 : 0;
-				break;
-
-			case I_CMP_NE:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = wordReg[rid1].int_ != wordReg[rid2].int_ ? 1 : 0;
-				break;
-
-			case I_CMP_GT:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = wordReg[rid1].int_ > wordReg[rid2].int_ ? 1 : 0;
-				break;
-
-			case I_CMP_LT:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = wordReg[rid1].int_ < wordReg[rid2].int_ ? 1 : 0;
-				break;
-
-			case I_CMP_GE:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = wordReg[rid1].int_ >= wordReg[rid2].int_ ? 1 : 0;
-				break;
-
-			case I_CMP_LE:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = wordReg[rid1].int_ <= wordReg[rid2].int_ ? 1 : 0;
-				break;
-
-			case I_INC:
-				program.read<reg_t>(&rid1);
-				wordReg[rid1].int_++;
-				byteReg[register_::FZ].bool_ = wordReg[rid1].int_ == 0 ? 0 : 1;
-				break;
-
-			case I_DEC:
-				program.read<reg_t>(&rid1);
-				wordReg[rid1].int_--;
-				byteReg[register_::FZ].bool_ = wordReg[rid1].int_ == 0 ? 0 : 1;
-				break;
-
-			case I_ADD:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				wordReg[rid1].int_ = wordReg[rid2].int_ + wordReg[rid3].int_;
-				byteReg[register_::FZ].bool_ = wordReg[rid1].int_ == 0 ? 0 : 1;
-				break;
-
-			case I_SUB:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				wordReg[rid1].int_ = wordReg[rid2].int_ - wordReg[rid3].int_;
-				byteReg[register_::FZ].bool_ = wordReg[rid1].int_ == 0 ? 0 : 1;
-				break;
-
-			case I_MUL:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				wordReg[rid1].int_ = wordReg[rid2].int_ * wordReg[rid3].int_;
-				byteReg[register_::FZ].bool_ = wordReg[rid1].int_ == 0 ? 0 : 1;
-				break;
-
-			case I_DIV:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				if (wordReg[rid3].int_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, program.ip - program.start);
-				wordReg[rid1].int_ = wordReg[rid2].int_ / wordReg[rid3].int_;
-				byteReg[register_::FZ].bool_ = wordReg[rid1].int_ == 0 ? 0 : 1;
-				break;
-
-			case I_MOD:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				if (wordReg[rid3].int_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, program.ip - program.start);
-				wordReg[rid1].int_ = wordReg[rid2].int_ % wordReg[rid3].int_;
-				byteReg[register_::FZ].bool_ = wordReg[rid1].int_ == 0 ? 0 : 1;
-				break;
-
-			case I_TO_C:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[rid1].char_ = static_cast<char_t>(wordReg[rid2].int_);
-				break;
-
-			case I_TO_F:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				wordReg[rid1].float_ = static_cast<float_t>(wordReg[rid2].int_);
-				break;
-
-			case C_FLAG:
-				program.read<reg_t>(&rid1);
-				byteReg[register_::FZ].bool_ = byteReg[rid1].char_ == 0 ? 0 : 1;
-				// TODO : Set other flags if they exist?
-				break;
-
-			case C_CMP_EQ:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = byteReg[rid1].char_ == byteReg[rid2].char_ ? 1 : 0;
-				break;
-
-			case C_CMP_NE:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = byteReg[rid1].char_ != byteReg[rid2].char_ ? 1 : 0;
-				break;
+	// Instructions each handler retires: one, or the length of a superinstruction
+	struct RetiredCounts {
+		uint8_t n[execop::COUNT];
 
-			case C_CMP_GT:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = byteReg[rid1].char_ > byteReg[rid2].char_ ? 1 : 0;
-				break;
+		constexpr RetiredCounts() : n() {
+			for (int op = 0; op < execop::COUNT; op++) n[op] = 1;
+#define FUSION_LENGTH(op, ...) n[op] = static_cast<uint8_t>(std::initializer_list<int>{ __VA_ARGS__ }.size());
+			EXEC_FUSIONS(FUSION_LENGTH)
+#undef FUSION_LENGTH
+		}
+	};
 
-			case C_CMP_LT:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = byteReg[rid1].char_ < byteReg[rid2].char_ ? 1 : 0;
-				break;
+	constexpr RetiredCounts retiredBy;
 
-			case C_CMP_GE:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = byteReg[rid1].char_ >= byteReg[rid2].char_ ? 1 : 0;
-				break;
+	// Runs before every instruction, including the final HALT
+	// Compiles to nothing in the FEATURE_NONE instance
+	template<int Features>
+	inline void onInstr_(Machine& m, const Instr* ip) {
+		if (Features & FEATURE_DEBUG) {
+			m.output->flush();
+			m.streamOut << IO_DEBUG "BYTE" << ip->loc << " : " << instrName(ip->op) << IO_NORM "\n";
+		}
+		if (Features & FEATURE_PROFILE) {
+			m.profiler->onInstr(ip);
+		}
+		if (Features & FEATURE_SAMPLE) {
+			m.sampler->current.store(ip, std::memory_order_relaxed);
+		}
+		if (Features & FEATURE_COUNT) {
+			m.retired += retiredBy.n[ip->op];
+		}
+	}
 
-			case C_CMP_LE:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = byteReg[rid1].char_ <= byteReg[rid2].char_ ? 1 : 0;
-				break;
+	// Runs after every handler, with the instruction it ran and the one it returned
+	// Compiles to nothing except for taken jumps in FEATURE_JIT instances
+	template<int Features, int Op>
+	inline const Instr* afterOp_(Machine& m, const Instr* ip, const Instr* next) {
+		if ((Features & FEATURE_JIT) && (Op == JMP || Op == JMP_Z || Op == JMP_NZ) && next != ip + 1) {
+			return m.jit->enter(ip, next);
+		}
+		return next;
+	}
 
-			case C_INC:
-				program.read<reg_t>(&rid1);
-				byteReg[rid1].char_++;
-				byteReg[register_::FZ].bool_ = byteReg[rid1].char_ == 0 ? 0 : 1;
-				break;
+	template<int Features>
+	void execSwitch_(Machine& m) {
+		const Instr* ip = m.code + m.program.entry;
+
+		while (true) {
+			onInstr_<Features>(m, ip);
+
+			switch (ip->op) {
+#define CASE_OP(op) case op: ip = afterOp_<Features, op>(m, ip, op_##op(m, ip)); break;
+#define CASE_FUSED(op, ...) CASE_OP(op)
+#define CASE_NO_FLAGS(op) CASE_OP(op##_NF)
+				EXEC_OPCODES(CASE_OP)
+				EXEC_FUSIONS(CASE_FUSED)
+				EXEC_NO_FLAGS(CASE_NO_FLAGS)
+#undef CASE_NO_FLAGS
+#undef CASE_FUSED
+#undef CASE_OP
+
+				// The end of a green thread, or of the time it got on this worker
+				case HALT:
+					ip = m.scheduler->next(m);
+					if (ip == nullptr) return;
+					break;
+
+				default:
+					throw ExecutorException(ExecutorException::UNKNOWN_OPCODE, ip->loc + 1);
+			}
+		}
+	}
 
-			case C_DEC:
-				program.read<reg_t>(&rid1);
-				byteReg[rid1].char_--;
-				byteReg[register_::FZ].bool_ = byteReg[rid1].char_ == 0 ? 0 : 1;
-				break;
+#if Z_HAS_COMPUTED_GOTO
+	template<int Features>
+	void execGoto_(Machine& m) {
+		HandlerRef labels[COUNT] = {};
+#define LABEL_OP(op) labels[op].label = &&L_##op;
+#define LABEL_FUSED(op, ...) LABEL_OP(op)
+#define LABEL_NO_FLAGS(op) LABEL_OP(op##_NF)
+		EXEC_OPCODES(LABEL_OP)
+		EXEC_FUSIONS(LABEL_FUSED)
+		EXEC_NO_FLAGS(LABEL_NO_FLAGS)
+#undef LABEL_NO_FLAGS
+#undef LABEL_FUSED
+#undef LABEL_OP
+		labels[HALT].label = &&L_HALT;
+
+		m.program.link(labels);
+
+		const Instr* ip = m.code + m.program.entry;
+
+#define DISPATCH() onInstr_<Features>(m, ip); goto *ip->handler.label
+		DISPATCH();
+
+#define GOTO_OP(op) L_##op: ip = afterOp_<Features, op>(m, ip, op_##op(m, ip)); DISPATCH();
+#define GOTO_FUSED(op, ...) GOTO_OP(op)
+#define GOTO_NO_FLAGS(op) GOTO_OP(op##_NF)
+		EXEC_OPCODES(GOTO_OP)
+		EXEC_FUSIONS(GOTO_FUSED)
+		EXEC_NO_FLAGS(GOTO_NO_FLAGS)
+#undef GOTO_NO_FLAGS
+#undef GOTO_FUSED
+#undef GOTO_OP
+
+	L_HALT:
+		ip = m.scheduler->next(m);
+		if (ip == nullptr) return;
+		DISPATCH();
+#undef DISPATCH
+	}
+#endif
+
+	// Tail-call threading: every handler ends by calling the next one
+#ifdef Z_MUSTTAIL
+#define TAIL_DISPATCH(m, ip) Z_MUSTTAIL return ip->handler.fn(m, ip)
+#else
+	// Without guaranteed tail calls, return to the trampoline in execTailcall_
+#define TAIL_DISPATCH(m, ip) return ip
+#endif
+
+#define TAIL_OP(op) \
+	template<int Features> \
+	const Instr* tail_##op(Machine& m, const Instr* ip) { ip = afterOp_<Features, op>(m, ip, op_##op(m, ip)); onInstr_<Features>(m, ip); TAIL_DISPATCH(m, ip); }
+#define TAIL_FUSED(op, ...) TAIL_OP(op)
+#define TAIL_NO_FLAGS(op) TAIL_OP(op##_NF)
+	EXEC_OPCODES(TAIL_OP)
+	EXEC_FUSIONS(TAIL_FUSED)
+	EXEC_NO_FLAGS(TAIL_NO_FLAGS)
+#undef TAIL_NO_FLAGS
+#undef TAIL_FUSED
+#undef TAIL_OP
+
+	template<int Features>
+	const Instr* tail_HALT(Machine& m, const Instr* ip) {
+		ip = m.scheduler->next(m);
+		if (ip == nullptr) return nullptr;
+		onInstr_<Features>(m, ip);
+		TAIL_DISPATCH(m, ip);
+	}
 
-			case C_ADD:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				byteReg[rid1].char_ = byteReg[rid2].char_ + byteReg[rid3].char_;
-				byteReg[register_::FZ].bool_ = byteReg[rid1].char_ == 0 ? 0 : 1;
-				break;
+	template<int Features>
+	void execTailcall_(Machine& m) {
+		HandlerRef handlers[COUNT] = {};
+#define TABLE_OP(op) handlers[op].fn = tail_##op<Features>;
+#define TABLE_FUSED(op, ...) TABLE_OP(op)
+#define TABLE_NO_FLAGS(op) TABLE_OP(op##_NF)
+		EXEC_OPCODES(TABLE_OP)
+		EXEC_FUSIONS(TABLE_FUSED)
+		EXEC_NO_FLAGS(TABLE_NO_FLAGS)
+#undef TABLE_NO_FLAGS
+#undef TABLE_FUSED
+#undef TABLE_OP
+		handlers[HALT].fn = tail_HALT<Features>;
+
+		m.program.link(handlers);
+
+		const Instr* ip = m.code + m.program.entry;
+		onInstr_<Features>(m, ip);
+#ifdef Z_MUSTTAIL
+		ip->handler.fn(m, ip);
+#else
+		while (ip) ip = ip->handler.fn(m, ip);
+#endif
+	}
 
-			case C_SUB:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				byteReg[rid1].char_ = byteReg[rid2].char_ - byteReg[rid3].char_;
-				byteReg[register_::FZ].bool_ = byteReg[rid1].char_ == 0 ? 0 : 1;
-				break;
+	// Disarms a StackTrap however run_ is left
+	class Armed {
+	public:
+		Armed(StackTrap& trapIn) : trap(trapIn) {
+			trap.arm();
+		}
 
-			case C_MUL:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				byteReg[rid1].char_ = byteReg[rid2].char_ * byteReg[rid3].char_;
-				byteReg[register_::FZ].bool_ = byteReg[rid1].char_ == 0 ? 0 : 1;
-				break;
+		~Armed() {
+			trap.disarm();
+		}
 
-			case C_DIV:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				if (byteReg[rid3].char_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, program.ip - program.start);
-				byteReg[rid1].char_ = byteReg[rid2].char_ / byteReg[rid3].char_;
-				byteReg[register_::FZ].bool_ = byteReg[rid1].char_ == 0 ? 0 : 1;
-				break;
+	private:
+		StackTrap& trap;
+	};
 
-			case C_MOD:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				if (byteReg[rid3].char_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, program.ip - program.start);
-				byteReg[rid1].char_ = byteReg[rid2].char_ % byteReg[rid3].char_;
-				byteReg[register_::FZ].bool_ = byteReg[rid1].char_ == 0 ? 0 : 1;
+	// Runs m from its program's entry until the scheduler has nothing left for it
+	// Never inlined into run_, where sigsetjmp would keep the compiler from optimizing the engines
+	template<int Features>
+	Z_NOINLINE void dispatch_(Machine& m, Dispatch dispatch) {
+		switch (dispatch) {
+#if Z_HAS_COMPUTED_GOTO
+			case Dispatch::GOTO:
+				execGoto_<Features>(m);
 				break;
+#endif
 
-			case C_TO_I:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				wordReg[rid1].int_ = static_cast<char_t>(byteReg[rid2].char_);
+			case Dispatch::TAILCALL:
+				execTailcall_<Features>(m);
 				break;
 
-			case C_TO_F:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				wordReg[rid1].float_ = static_cast<float_t>(byteReg[rid2].char_);
+			default:
+				execSwitch_<Features>(m);
 				break;
+		}
+	}
 
-			case F_FLAG:
-				program.read<reg_t>(&rid1);
-				byteReg[register_::FZ].bool_ = wordReg[rid1].float_ == 0 ? 0 : 1;
-				// TODO : Set other flags if they exist?
-				break;
+	// dispatch_, with an access out of bounds caught by the trap coming back here to be thrown from the instruction that
+	// made it, as a stack overflow if it was past the stack limit
+	template<int Features>
+	void run_(Machine& m, Dispatch dispatch) {
+		Armed armed(m.trap);
+#if Z_STACK_TRAP
+		if (sigsetjmp(m.trap.jump, 1) != 0) {
+			// access is left over from the last interpreted access when the JIT's code overflowed
+			const Instr* at = m.jit != nullptr ? m.jit->accessAt(m.trap.pc) : nullptr;
+			if (at == nullptr) at = static_cast<const Instr*>(m.trap.access);
+			const int loc = at != nullptr ? at->loc : -1;
+			if (m.trap.overflow) throw ExecutorException(ExecutorException::STACK_OVERFLOW, loc, "address " + std::to_string(m.trap.address) + " is past the stack limit");
+			throw ExecutorException(ExecutorException::OUT_OF_BOUNDS, loc, "address " + std::to_string(m.trap.address));
+		}
+#endif
+		dispatch_<Features>(m, dispatch);
+	}
 
-			case F_CMP_EQ:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = wordReg[rid1].float_ == wordReg[rid2].float_ ? 1 : 0;
-				break;
+	// Debug and profile want to see every instruction, and the JIT every jump and only opcodes it can record, so they run
+	// unfused and with every flag set
+	// So does a run taking a snapshot, whose label could otherwise be inside a superinstruction
+	template<int Features>
+	bool fuses_(const ExecutorSettings& execSettings) {
+		return execSettings.fuse && execSettings.snapshotLabel == nullptr && !(Features & (FEATURE_DEBUG | FEATURE_PROFILE | FEATURE_JIT));
+	}
 
-			case F_CMP_NE:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = wordReg[rid1].float_ != wordReg[rid2].float_ ? 1 : 0;
-				break;
+	// Every worker but main, see Scheduler
+	template<int Features>
+	void worker_(Scheduler& scheduler, unsigned int index) {
+		Machine& main = scheduler.main;
+
+		Program program(main.program.start, main.program.end);
+		Machine m(program, main.stack, main.streamOut, main.streamIn);
+		m.base = main.base;
+		m.output = main.output;
+		m.heap = main.heap;
+		program.verified = main.program.verified;
+		program.decode(m.wordReg, m.byteReg, m.vecReg, fuses_<Features>(scheduler.execSettings));
+		// HALT asks the scheduler for a thread
+		program.entry = program.haltIndex;
+		m.code = program.instrs.data();
+		scheduler.attach(m, index);
+
+		Jit jit;
+		if (Features & FEATURE_JIT) {
+			m.jit = &jit;
+			jit.start(m);
+		}
 
-			case F_CMP_GT:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = wordReg[rid1].float_ > wordReg[rid2].float_ ? 1 : 0;
-				break;
+		try {
+			run_<Features>(m, scheduler.execSettings.dispatch);
+		} catch (...) {
+			scheduler.fail(std::current_exception());
+		}
+		scheduler.addRetired(m.retired);
+	}
+}
 
-			case F_CMP_LT:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = wordReg[rid1].float_ < wordReg[rid2].float_ ? 1 : 0;
-				break;
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-			case F_CMP_GE:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = wordReg[rid1].float_ >= wordReg[rid2].float_ ? 1 : 0;
-				break;
+namespace {
+	typedef int (*ExecInstance)(Program&, ExecutorSettings&, std::ostream&, std::istream&, std::istream*);
 
-			case F_CMP_LE:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[register_::FZ].bool_ = wordReg[rid1].float_ <= wordReg[rid2].float_ ? 1 : 0;
-				break;
+	template<int Features>
+	constexpr ExecInstance instance_(std::true_type) {
+		return exec_<Features>;
+	}
 
-			case F_ADD:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				wordReg[rid1].float_ = wordReg[rid2].float_ + wordReg[rid3].float_;
-				byteReg[register_::FZ].bool_ = wordReg[rid1].float_ == 0 ? 0 : 1;
-				break;
+	template<int Features>
+	constexpr ExecInstance instance_(std::false_type) {
+		return nullptr;
+	}
 
-			case F_SUB:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				wordReg[rid1].float_ = wordReg[rid2].float_ - wordReg[rid3].float_;
-				byteReg[register_::FZ].bool_ = wordReg[rid1].float_ == 0 ? 0 : 1;
-				break;
+	// Native code skips the per-instruction hooks, so the JIT never runs alongside anything else
+	template<int... Features>
+	constexpr std::array<ExecInstance, FEATURE_SETS> makeInstances_(std::integer_sequence<int, Features...>) {
+		return { { instance_<Features>(std::integral_constant<bool, !(Features & FEATURE_JIT) || Features == FEATURE_JIT>())... } };
+	}
+}
 
-			case F_MUL:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				wordReg[rid1].float_ = wordReg[rid2].float_ * wordReg[rid3].float_;
-				byteReg[register_::FZ].bool_ = wordReg[rid1].float_ == 0 ? 0 : 1;
-				break;
+int vm::executor::exec_(Program& program, ExecutorSettings& execSettings, std::ostream& streamOut, std::istream& streamIn, std::istream* symbolFile) {
+	static constexpr std::array<ExecInstance, FEATURE_SETS> instances = makeInstances_(std::make_integer_sequence<int, FEATURE_SETS>());
+
+	int features = FEATURE_NONE;
+	if (execSettings.flags.hasFlags(FLAG_DEBUG)) features |= FEATURE_DEBUG;
+	if (execSettings.flags.hasFlags(FLAG_PROFILE)) features |= FEATURE_PROFILE;
+	if (execSettings.samplePath != nullptr) features |= FEATURE_SAMPLE;
+	if (execSettings.retiredOut != nullptr) features |= FEATURE_COUNT;
+
+	// Instrumented runs stay interpreted
+	if (execSettings.jit) {
+		if (features == FEATURE_NONE) {
+			features |= FEATURE_JIT;
+		} else {
+			streamOut << IO_WARN "The JIT is off while debugging, profiling, sampling or counting" IO_NORM "\n";
+		}
+	}
 
-			case F_DIV:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				if (wordReg[rid3].float_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, program.ip - program.start);
-				wordReg[rid1].float_ = wordReg[rid2].float_ / wordReg[rid3].float_;
-				byteReg[register_::FZ].bool_ = wordReg[rid1].float_ == 0 ? 0 : 1;
-				break;
+	return instances[features](program, execSettings, streamOut, streamIn, symbolFile);
+}
 
-			case F_MOD:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				program.read<reg_t>(&rid3);
-				if (wordReg[rid3].float_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, program.ip - program.start);
-				wordReg[rid1].float_ = wordReg[rid2].float_ * modf(wordReg[rid2].float_ / wordReg[rid3].float_, &float_);
-				byteReg[register_::FZ].bool_ = wordReg[rid1].float_ == 0 ? 0 : 1;
-				break;
+template<int Features>
+int vm::executor::exec_(Program& program, ExecutorSettings& execSettings, std::ostream& streamOut, std::istream& streamIn, std::istream* symbolFile) {
+	using namespace types;
 
-			case F_TO_C:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				byteReg[rid1].char_ = static_cast<char_t>(wordReg[rid2].float_);
-				break;
+	Stack stack(program.memory, execSettings.stackSize, execSettings.stackLimit);
+	Machine m(program, stack, streamOut, streamIn);
+	m.base = program.memory.base;
+	OutputBuffer output(streamOut);
+	m.output = &output;
+	// Everything the program leaves allocated goes with it
+	Heap heap(program.memory);
+	m.heap = &heap;
+	m.wordReg[register_::BP].word = wordAddress(m.base, stack.start);
+	m.wordReg[register_::RP].word = wordAddress(m.base, stack.start);
+	m.wordReg[register_::PP].word = wordAddress(m.base, program.start);
+	m.byteReg[register_::FZ].bool_ = 0;
+
+	// A malformed program is rejected before any of it runs, which a cache hit already knows it isn't
+	if (execSettings.cachePath != nullptr) {
+		program.decode(m.wordReg, m.byteReg, m.vecReg, fuses_<Features>(execSettings), execSettings.cachePath, execSettings.verify);
+	} else {
+		if (execSettings.verify) program.verify();
+		program.decode(m.wordReg, m.byteReg, m.vecReg, fuses_<Features>(execSettings));
+	}
+	m.code = program.instrs.data();
 
-			case F_TO_I:
-				program.read<reg_t>(&rid1);
-				program.read<reg_t>(&rid2);
-				wordReg[rid1].int_ = static_cast<int_t>(wordReg[rid2].float_);
-				break;
+	// A restored program carries on from its label, with everything as it was there
+	if (program.resume != nullptr) program.entry = program.resume->resume(m, heap);
 
-			case PRNT_C:
-				program.read<reg_t>(&rid1);
-				streamOut << byteReg[rid1].char_;
-				break;
+	SymbolTable symbols;
+	if (symbolFile != nullptr) symbols.load(*symbolFile);
 
-			case PRNT_STR:
-				program.read<reg_t>(&rid1);
-				program.read<word_t>(&word);
-				streamOut << reinterpret_cast<char*>(wordReg[rid1].word + word);
-				break;
+	Snapshot snapshot;
+	if (execSettings.snapshotLabel != nullptr) snapshot.arm(m, symbols, execSettings.snapshotLabel, execSettings.snapshotPath);
 
-			case READ_C:
-				program.read<reg_t>(&rid1);
-				streamIn.get(rlchar);
-				byteReg[rid1].char_ = rlchar;
-				break;
+	Profiler profiler;
+	if (Features & FEATURE_PROFILE) {
+		m.profiler = &profiler;
+		profiler.start(program);
+	}
 
-			case READ_STR:
-				program.read<reg_t>(&rid1);
-				program.read<word_t>(&word);
-				streamIn.getline(reinterpret_cast<char*>(wordReg[rid1].word + word), std::numeric_limits<std::streamsize>::max(), '\n');
-				break;
+	// Without native code, enter() just hands every jump back to the interpreter
+	Jit jit;
+	if (Features & FEATURE_JIT) {
+		m.jit = &jit;
+		if (!jit.start(m)) streamOut << IO_WARN "The JIT is not available on this platform, interpreting instead" IO_NORM "\n";
+	}
 
-			case R_PRNT_I:
-				program.read<reg_t>(&rid1);
-				streamOut << wordReg[rid1].int_;
-				break;
+	// Stops its timer when destroyed, including when the program throws
+	Sampler sampler;
+	if (Features & FEATURE_SAMPLE) {
+		m.sampler = &sampler;
+		if (!sampler.start(m, execSettings.sampleInterval)) {
+			streamOut << IO_WARN "Sampling needs SIGPROF, which this platform doesn't have" IO_NORM "\n";
+		}
+	}
 
-			case R_PRNT_F:
-				program.read<reg_t>(&rid1);
-				streamOut << wordReg[rid1].float_;
-				break;
+#if !Z_HAS_COMPUTED_GOTO
+	if (execSettings.dispatch == Dispatch::GOTO) {
+		streamOut << IO_WARN "Computed goto dispatch is not supported by this compiler, using switch dispatch" IO_NORM "\n";
+	}
+#endif
 
-			case PRNT_LN:
-				streamOut << '\n';
-				break;
+	// Instrumentation follows a single machine, so green threads share one worker there, as they do for a snapshot
+	unsigned int workers = 1;
+	if (!(Features & (FEATURE_DEBUG | FEATURE_PROFILE | FEATURE_SAMPLE)) && execSettings.snapshotLabel == nullptr) {
+		workers = execSettings.threads > 0 ? execSettings.threads : std::max(1u, std::thread::hardware_concurrency());
+	}
 
-			case TIME:
-				program.read<reg_t>(&rid1);
-				wordReg[rid1].int_ = std::time(nullptr);
-				break;
+	// Declared last, so its workers are stopped before anything they use goes away
+	Scheduler scheduler(m, execSettings, worker_<Features>, workers);
+	run_<Features>(m, execSettings.dispatch);
+	const uint64_t workerRetired = scheduler.finish();
+	output.flush();
+
+	if (Features & FEATURE_PROFILE) {
+		profiler.stop(program, symbols);
+		streamOut << "\n";
+		profiler.report(streamOut);
+		heap.report(streamOut);
+
+		if (execSettings.profilePath != nullptr) {
+			std::fstream json;
+			json.open(execSettings.profilePath, std::ios::out);
+			if (json.is_open()) {
+				profiler.writeJson(json);
+			} else {
+				streamOut << IO_WARN "Could not open profile output file \"" << execSettings.profilePath << "\"" IO_NORM "\n";
+			}
+		}
+	}
 
-			default:
-				throw ExecutorException(ExecutorException::UNKNOWN_OPCODE, program.ip - program.start);
-				break;
+	if (Features & FEATURE_SAMPLE) {
+		sampler.stop();
+
+		std::fstream folded;
+		folded.open(execSettings.samplePath, std::ios::out | std::ios::trunc);
+		if (folded.is_open()) {
+			sampler.writeFolded(folded, symbols);
+			streamOut << "\n" IO_PROFILE << sampler.samples() << " samples written to \"" << execSettings.samplePath << "\"";
+			if (sampler.dropped() > 0) streamOut << " (" << sampler.dropped() << " dropped, sample buffer full)";
+			streamOut << IO_NORM "\n";
+		} else {
+			streamOut << IO_WARN "Could not open sample output file \"" << execSettings.samplePath << "\"" IO_NORM "\n";
 		}
 	}
 
-end:;
-	// TODO: automatic memory cleanup
+	if (Features & FEATURE_COUNT) *execSettings.retiredOut = m.retired + workerRetired;
+
 	streamOut << IO_END;
 
 	return 0;
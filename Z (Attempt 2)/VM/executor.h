@@ -1,4 +1,45 @@
+#pragma once
+
 #include "vm.h"
+#include "executorfusions.h"
+#include "memory.h"
+#include "mapping.h"
+#include "heap.h"
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <cstdio>
+#include <cstring>
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Dispatch engine support
+
+// Computed goto ("labels as values") is a GCC/Clang extension
+#if defined(__GNUC__) || defined(__clang__)
+#define Z_HAS_COMPUTED_GOTO 1
+#else
+#define Z_HAS_COMPUTED_GOTO 0
+#endif
+
+// Guaranteed tail calls; without them the tail-call engine runs its handlers from a trampoline loop
+#if defined(__has_cpp_attribute)
+#if __has_cpp_attribute(clang::musttail)
+#define Z_MUSTTAIL [[clang::musttail]]
+#endif
+#endif
+
+// Keeps a function out of its callers
+#ifdef _MSC_VER
+#define Z_NOINLINE __declspec(noinline)
+#else
+#define Z_NOINLINE __attribute__((noinline))
+#endif
+
+// Build-time default engine, override with e.g. /D Z_DEFAULT_DISPATCH=GOTO
+#ifndef Z_DEFAULT_DISPATCH
+#define Z_DEFAULT_DISPATCH SWITCH
+#endif
 
 namespace vm {
 	namespace executor {
@@ -7,13 +48,29 @@ namespace vm {
 			enum ErrorType {
 				UNKNOWN_OPCODE,
 				DIVIDE_BY_ZERO,
-				BAD_ALLOC
+				BAD_ALLOC,
+				INVALID_REGISTER,
+				THREAD_LIMIT,
+				INVALID_THREAD,
+				DEADLOCK,
+				STACK_OVERFLOW,
+				SNAPSHOT,
+				OUT_OF_BOUNDS,
+				INVALID_BYTECODE
 			};
 
 			static constexpr const char* const errorStrings[] = {
 				"Unknown opcode",
 				"Division (or modulo) by zero",
-				"Dynamic memory allocation error"
+				"Dynamic memory allocation error",
+				"Invalid register ID",
+				"No stack left for another thread",
+				"Invalid thread ID",
+				"Every thread is waiting to join another",
+				"Stack overflow",
+				"Could not take a snapshot",
+				"Memory access out of bounds",
+				"Invalid bytecode"
 			};
 
 			const ErrorType eType;
@@ -37,28 +94,218 @@ namespace vm {
 			}
 		};
 
+		enum class Dispatch {
+			SWITCH,		// One big switch statement
+			GOTO,		// Direct threading with computed goto
+			TAILCALL	// One handler function per opcode, each tail-calling the next
+		};
+
+		constexpr const char* const dispatchStrings[] = {
+			"switch",
+			"goto",
+			"tailcall"
+		};
+
 		struct ExecutorSettings {
 			Flags flags;
 			unsigned int stackSize;
+			unsigned int stackLimit;	// Bytes the stack can grow to as it's used, if more than stackSize
+			Dispatch dispatch;
+			bool fuse;
+			bool verify;				// Checks the bytecode once at load (Program::verify), instead of as it's decoded
+			const char* profilePath;	// JSON output for -profile, or nullptr
+			const char* samplePath;		// Folded-stack output for -sample, or nullptr to not sample
+			int sampleInterval;			// Microseconds between samples
+			bool jit;
+			uint64_t* retiredOut;		// Instructions retired are counted and stored here, or nullptr to not count
+			unsigned int threads;		// Workers for -execbatch and for green threads, or 0 for one per hardware thread
+			unsigned int threadStackSize;	// Bytes of the stack given to each spawned green thread
+			const char* cachePath;		// Directory of decoded programs for -cache, or nullptr to always decode
+			const char* snapshotLabel;	// Where -snapshotat takes its snapshot, or nullptr to not take one
+			const char* snapshotPath;
 
-			ExecutorSettings() : stackSize(0x1000) {}
+			ExecutorSettings() : stackSize(0x1000), stackLimit(0x100000), dispatch(Dispatch::Z_DEFAULT_DISPATCH), fuse(true), verify(true), profilePath(nullptr), samplePath(nullptr), sampleInterval(1000), jit(false), retiredOut(nullptr), threads(0), threadStackSize(0x400), cachePath(nullptr), snapshotLabel(nullptr), snapshotPath(nullptr) {}
 		};
 
-		class Program {
-			static constexpr int FILLER_SIZE = 24;
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Decoded instructions
+
+		struct Instr;
+		struct Machine;
+		class Profiler;
+		class Sampler;
+		class Jit;
+		class Scheduler;
+		class Snapshot;
+		struct GreenThread;
+		typedef const Instr* (*Handler)(Machine& m, const Instr* ip);
 
+		// Handler IDs that only exist in decoded programs, numbered after the real opcodes
+		namespace execop {
+			enum {
+				BAD_OPCODE = opcode::count,	// Unknown opcode byte, throws when reached
+				BAD_REGISTER,				// Instruction with an out-of-range register ID, throws when reached
+				SNAPSHOT,					// Stands in for the instruction at -snapshotat's label until it's reached
+#define FUSION_ID(op, ...) op,
+				EXEC_FUSIONS(FUSION_ID)		// Superinstructions, see executorfusions.h
+#undef FUSION_ID
+#define NO_FLAGS_ID(op) op##_NF,
+				EXEC_NO_FLAGS(NO_FLAGS_ID)	// Arithmetic whose FZ nothing reads, see Program::elideFlags
+#undef NO_FLAGS_ID
+				COUNT
+			};
+		}
+
+		constexpr const char* const execopStrings[] = {
+			"<bad opcode>",
+			"<bad register>",
+			"<snapshot>",
+#define FUSION_STRING(op, ...) #op,
+			EXEC_FUSIONS(FUSION_STRING)
+#undef FUSION_STRING
+#define NO_FLAGS_STRING(op) #op "_NF",
+			EXEC_NO_FLAGS(NO_FLAGS_STRING)
+#undef NO_FLAGS_STRING
+		};
+
+		inline const char* instrName(int op) {
+			return op < opcode::count ? opcode::strings[op] : execopStrings[op - opcode::count];
+		}
+
+		union Operand {
+			types::WordVal* word;
+			types::ByteVal* byte;
+			types::VecVal* vec;
+		};
+
+		union HandlerRef {
+			const void* label;	// Computed goto engine
+			Handler fn;			// Tail-call engine
+		};
+
+		// One instruction, decoded once so the engines never touch the raw bytecode
+		struct alignas(16) Instr {
+			HandlerRef handler;		// Set by the dispatch engine (Program::link)
+			Operand a, b, c;		// Register operands, in bytecode order
+			types::word_t imm;		// Word or byte immediate
+			int target;				// Jump target as an index into Program::instrs
+			int loc;				// Byte offset of the opcode, for error reporting
+			uint16_t op;			// Opcode or execop
+		};
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+		class Program {
 		public:
+			static constexpr int FILLER_SIZE = 24;	// Bytes of HALT after the end, so reads past it stay in bounds
+			// When each file deciding what decode() produces and how it runs was compiled (the decoder with its fusion and
+			// elision tables, the engines with the handlers, the verifier), so the decode cache can tell builds apart even
+			// when only one of them was rebuilt
+			static const char* const decoderBuilt;
+			static const char* const executorBuilt;
+			static const char* const verifierBuilt;
+
 			char* start;
 			char* ip;
 			char* end;
 
-			Program(std::iostream& program) {
+			// Both loading constructors reserve the program's Memory and place it there, and throw std::bad_alloc if they can't
+			Program(std::iostream& program) : entry(0), haltIndex(0), opened(true), resume(nullptr), verified(false), wordReg(nullptr), byteReg(nullptr), vecReg(nullptr), handlers(nullptr), fusing(false) {
+				memory.reserve();
+				load(program);
+			}
+
+			// Maps the file where the platform allows (see MappedFile), otherwise reads it like the stream constructor
+			// Leaves an empty program, with opened unset, if the file can't be opened
+			Program(const char* path) : entry(0), haltIndex(0), opened(true), resume(nullptr), verified(false), wordReg(nullptr), byteReg(nullptr), vecReg(nullptr), handlers(nullptr), fusing(false) {
+				memory.reserve();
+				if (mapping.map(path, FILLER_SIZE, &memory)) {
+					start = mapping.start;
+					ip = start;
+					end = start + mapping.length;
+				} else {
+					std::fstream file;
+					file.open(path, std::ios::in | std::ios::binary);
+					opened = file.is_open();
+					load(file);
+				}
+			}
+
+			// An empty program with its Memory reserved, for Snapshot::load to restore into
+			Program() : start(nullptr), ip(nullptr), end(nullptr), entry(0), haltIndex(0), opened(true), resume(nullptr), verified(false), wordReg(nullptr), byteReg(nullptr), vecReg(nullptr), handlers(nullptr), fusing(false) {
+				memory.reserve();
+			}
+
+			// Shares another program's memory, so it can be decoded again against other registers
+			Program(char* startIn, char* endIn) : start(startIn), ip(startIn), end(endIn), entry(0), haltIndex(0), opened(true), resume(nullptr), verified(false), wordReg(nullptr), byteReg(nullptr), vecReg(nullptr), handlers(nullptr), fusing(false) {}
+
+			void goto_(types::word_t loc) {
+				ip = start + loc;
+			}
+
+			template<typename T>
+			void read(T* val) {
+				(*val) = *reinterpret_cast<T*>(ip);
+				ip += sizeof(T);
+			}
+
+			// Decoded form of the program, built by decode()
+			// Runs of instructions are contiguous, and each run ends in a HALT or a jump to where decoding continues
+			std::vector<Instr> instrs;
+			// Index into instrs of the instruction decoded at each byte offset, or -1
+			std::vector<int> instrAt;
+			int entry;
+			int haltIndex;
+			bool opened;
+			// Holds the bytecode, then the stack and heap of the execution; never reserved for a shared program
+			Memory memory;
+			// State to continue from instead of the first instruction, see -restore
+			Snapshot* resume;
+			// Set by verify(), after which decode() trusts the bytecode
+			bool verified;
+
+			// Checks every instruction once, before decoding: that its opcode is known, its register IDs are in range for
+			// their classes, it ends before the program does, and any jump, call or spawn target it has is the start of an
+			// instruction (or the end of the program)
+			// Throws ExecutorException with the first problem found
+			void verify();
+
+			// Decodes from the first instruction and every static jump target, resolving registers against the given register files
+			// With fuse set, also replaces the start of each known sequence with its superinstruction, and arithmetic whose
+			// FZ is always overwritten before anything reads it with a variant that doesn't set it
+			void decode(types::WordVal* wordReg, types::ByteVal* byteReg, types::VecVal* vecReg, bool fuse);
+			// Same, but loaded from the cache in cacheDir when it has this program, and stored there when it doesn't
+			// With verify set, also verifies the program, unless the cache has it from a run that already did
+			// Must be called before the program runs, since globals are stored in the bytes the cache is keyed by
+			void decode(types::WordVal* wordReg, types::ByteVal* byteReg, types::VecVal* vecReg, bool fuse, const char* cacheDir, bool verify);
+			// Sets the engine's handler for every instruction, including ones decoded later
+			void link(const HandlerRef* handlersIn);
+			// Changes what one decoded instruction does, handler included
+			void setOp(const Instr* instr, uint16_t op);
+
+			// Resolves a jump to a byte address computed at runtime (R_JMP), decoding from there if nothing has yet
+			const Instr* jumpTarget(types::word_t loc) {
+				if (loc < 0 || loc >= end - start) return &instrs[haltIndex];
+				int index = instrAt[loc];
+				if (index < 0) index = decodeFrom(loc);
+				return &instrs[index];
+			}
+
+		private:
+			MappedFile mapping;		// After memory, so it's unmapped first
+			types::WordVal* wordReg;
+			types::ByteVal* byteReg;
+			types::VecVal* vecReg;
+			const HandlerRef* handlers;
+			bool fusing;
+
+			void load(std::iostream& program) {
 				// https://stackoverflow.com/questions/22984956/tellg-function-give-wrong-size-of-file
 				program.seekg(0, std::ios::beg);
 				program.ignore(std::numeric_limits<std::streamsize>::max());
 				std::streamsize length = program.gcount();
 
-				start = new char[length + FILLER_SIZE];
+				start = hostAddress(memory.base, memory.allocate(static_cast<size_t>(length) + FILLER_SIZE, true));
 				ip = start;
 				end = start + length;
 
@@ -69,37 +316,188 @@ namespace vm {
 				std::fill(start + length, start + length + FILLER_SIZE, charFiller);
 			}
 
-			~Program() {
-				delete[] start;
+			template<bool Verified> int decodeRun(int loc);
+			int decodeFrom(int loc, bool verifiedRun = false);
+			void fuse(size_t from);
+			void elideFlags(size_t from);
+			bool loadDecoded(const std::string& path, uint64_t content, types::WordVal* wordRegIn, types::ByteVal* byteRegIn, types::VecVal* vecRegIn, bool fuse, bool verify);
+			void storeDecoded(const std::string& path, uint64_t content);
+		};
+
+		// Allocated from the program's Memory, with a guard after it, and given back when destroyed
+		// Starts with size bytes and grows towards limit as it's touched, see Memory::allocateStack
+		class Stack {
+		public:
+			char* start;
+			char* end;		// Of everything it can grow to
+
+			Stack(Memory& memoryIn, const unsigned int& size, const unsigned int& limit) : memory(memoryIn), mark(memoryIn.mark()) {
+				const unsigned int capacity = std::max(size, limit);
+				start = hostAddress(memory.base, memory.allocateStack(size, capacity));
+				end = start + capacity;
 			}
 
-			void goto_(types::word_t loc) {
-				ip = start + loc;
+			~Stack() {
+				memory.release(mark);
 			}
 
-			template<typename T>
-			void read(T* val) {
-				(*val) = *reinterpret_cast<T*>(ip);
-				ip += sizeof(T);
+			// A green thread's slice of it, or nullptr once there's no room left, see Memory::carveStack
+			char* carve(size_t size) {
+				const uint32_t offset = memory.carveStack(size);
+				return offset == 0 ? nullptr : hostAddress(memory.base, offset);
 			}
+
+		private:
+			Memory& memory;
+			size_t mark;
 		};
 
-		class Stack {
+		// Output of the print opcodes, collected here and written to the stream in large blocks
+		// Flushed when full, before the input opcodes (so prompts appear), on FLUSH, and when exec_ ends, including by an
+		// exception. Numbers are formatted without the stream, the way operator<< formats them by default.
+		class OutputBuffer {
 		public:
-			char* start;
-			char* end;
+			static constexpr size_t SIZE = 0x10000;
 
-			Stack(const int& size) {
-				start = new char[size];
-				end = start + size;
+			OutputBuffer(std::ostream& streamIn) : stream(streamIn), data(SIZE), used(0) {}
+
+			~OutputBuffer() {
+				flush();
 			}
 
-			~Stack() {
-				delete[] start;
+			void put(char c) {
+				if (used == SIZE) flush();
+				data[used++] = c;
+			}
+
+			void write(const char* str, size_t length) {
+				if (used + length > SIZE) {
+					flush();
+					if (length > SIZE) {
+						stream.write(str, length);
+						return;
+					}
+				}
+				std::memcpy(data.data() + used, str, length);
+				used += length;
 			}
+
+			void writeInt(types::int_t value) {
+				char digits[12];
+				char* start = digits + sizeof(digits);
+				uint32_t magnitude = value < 0 ? 0u - static_cast<uint32_t>(value) : static_cast<uint32_t>(value);
+				do {
+					*--start = static_cast<char>('0' + magnitude % 10);
+					magnitude /= 10;
+				} while (magnitude != 0);
+				if (value < 0) *--start = '-';
+				write(start, digits + sizeof(digits) - start);
+			}
+
+			void writeFloat(types::float_t value) {
+				char digits[32];
+				int length = std::snprintf(digits, sizeof(digits), "%g", static_cast<double>(value));
+				write(digits, static_cast<size_t>(length));
+			}
+
+			void flush() {
+				if (used == 0) return;
+				stream.write(data.data(), used);
+				stream.flush();
+				used = 0;
+			}
+
+		private:
+			std::ostream& stream;
+			std::vector<char> data;
+			size_t used;
+		};
+
+		// Host-side copy of the frames CALL pushes, so RET can continue at the instruction without looking its location up,
+		// and the Sampler can walk calls without reading program memory
+		// Only ever a prediction, which RET checks against the frame it pops: frames built by hand, returns by R_JMP and
+		// calls deeper than SIZE just take the slow path
+		class ReturnStack {
+		public:
+			static constexpr unsigned int SIZE = 256;	// Power of 2; deeper calls overwrite the oldest entries
+
+			struct Entry {
+				const Instr* to;		// The instruction after the CALL
+				types::word_t frame;	// BP inside the call
+				types::word_t caller;	// BP to return to
+			};
+
+			Entry entries[SIZE];
+			unsigned int depth;		// Calls minus returns, wrapping around entries
+
+			ReturnStack() : entries(), depth(0) {}
+
+			void push(const Instr* to, types::word_t frame, types::word_t caller) {
+				Entry& entry = entries[depth++ & (SIZE - 1)];
+				entry.to = to;
+				entry.frame = frame;
+				entry.caller = caller;
+			}
+
+			// Where RET from frame to the instruction at loc goes, or nullptr if the prediction is wrong
+			const Instr* pop(types::word_t frame, types::word_t loc) {
+				if (depth == 0) return nullptr;
+				const Entry& entry = entries[--depth & (SIZE - 1)];
+				return entry.frame == frame && entry.to->loc == loc ? entry.to : nullptr;
+			}
+
+			void clear() {
+				depth = 0;
+			}
+		};
+
+		// Everything a handler can touch while executing
+		struct Machine {
+			Program& program;
+			Stack& stack;
+			types::WordVal wordReg[register_::COUNT];
+			types::ByteVal byteReg[register_::COUNT];
+			types::VecVal vecReg[register_::NUM_VECTOR_REGISTERS];
+			char* base;			// Word addresses are offsets from here, see Memory
+			std::ostream& streamOut;
+			std::istream& streamIn;
+			const Instr* code;	// Program::instrs, which never reallocates once decoded
+			Profiler* profiler;	// Only in FEATURE_PROFILE instances
+			Sampler* sampler;	// Only in FEATURE_SAMPLE instances
+			Jit* jit;			// Only in FEATURE_JIT instances
+			uint64_t retired;	// Only counted in FEATURE_COUNT instances
+			Scheduler* scheduler;
+			GreenThread* thread;	// Green thread running on this machine, or nullptr once it has been suspended
+			unsigned int worker;	// This machine's worker in the scheduler
+			std::mutex* ioLock;		// Held around console IO while more than one worker is running, or nullptr
+			OutputBuffer* output;	// Shared by every worker
+			Heap* heap;				// Shared by every worker
+			Snapshot* snapshot;		// Only until -snapshotat's label is reached
+			StackTrap trap;			// Armed while this machine runs, see run_
+			ReturnStack returns;
+
+			Machine(Program& programIn, Stack& stackIn, std::ostream& streamOutIn, std::istream& streamInIn) :
+				program(programIn), stack(stackIn), vecReg(), base(nullptr), streamOut(streamOutIn), streamIn(streamInIn), code(nullptr), profiler(nullptr), sampler(nullptr), jit(nullptr), retired(0),
+				scheduler(nullptr), thread(nullptr), worker(0), ioLock(nullptr), output(nullptr), heap(nullptr), snapshot(nullptr) {}
 		};
 
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Compile-time feature sets
+		// exec_ is instantiated once per combination, so instrumentation costs nothing in runs that don't ask for it
+
+		constexpr int FEATURE_NONE = 0;
+		constexpr int FEATURE_DEBUG = 1;		// Trace every instruction (-debug)
+		constexpr int FEATURE_PROFILE = 2;		// Count and time every instruction (-profile)
+		constexpr int FEATURE_SAMPLE = 4;		// Publish the current instruction for the sampling profiler (-sample)
+		constexpr int FEATURE_JIT = 8;			// Report taken jumps to the JIT, which runs hot regions natively (-jit)
+		constexpr int FEATURE_COUNT = 16;		// Count instructions retired (ExecutorSettings::retiredOut)
+		constexpr int FEATURE_SETS = 32;		// Size of the instance table; the JIT only has a plain instance
+
 		int exec(const char* const& path, ExecutorSettings& execSettings);
-		int exec_(std::iostream& file, ExecutorSettings& execSettings, std::ostream& stream, std::istream& streamIn);
+		// Picks the exec_ instance for execSettings.flags
+		// symbolFile is the assembler's symbol table for the program, or nullptr
+		int exec_(Program& program, ExecutorSettings& execSettings, std::ostream& stream, std::istream& streamIn, std::istream* symbolFile);
+		template<int Features>
+		int exec_(Program& program, ExecutorSettings& execSettings, std::ostream& stream, std::istream& streamIn, std::istream* symbolFile);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+// Superinstructions: opcode sequences the decoder fuses into a single handler (see Program::fuse)
+// X(name, ops...), most frequent first. The first entry that matches at an instruction wins.
+// Only the last op of a sequence may jump, since the fused handler assumes the others fall through.
+// Ops named by opcode also match their EXEC_NO_FLAGS variant, and run with flags; the _NF entries name the variants, so
+// sequences whose flags were elided keep that inside the superinstruction, and go before the entry they specialize.
+//
+// The table is curated by hand, nothing regenerates it: -profile prints the most frequent sequences as candidate X(...)
+// lines, and the ones worth a handler are copied in here. Counts are dynamic pair/triple counts from -profile over
+// AssemblyExamples, as of when each entry was added:
+//   10240  fdiv fadd fdiv      babylonian_sqrt, example1
+//   10240  idec jmpnz          babylonian_sqrt, example1
+//    2436  storew storew       fibonacci_recursive
+//    1219  icmple jmpz         fibonacci_recursive
+//    1219  loadw rjmp          fibonacci_recursive
+//    1218  movw iadd           fibonacci_recursive
+//     609  loadw idec storew   fibonacci_recursive
+
+#define EXEC_FUSIONS(X) \
+	X(FDIV_FADD_FDIV_NF, execop::F_DIV_NF, execop::F_ADD_NF, execop::F_DIV_NF) \
+	X(FDIV_FADD_FDIV, opcode::F_DIV, opcode::F_ADD, opcode::F_DIV) \
+	X(IDEC_JMPNZ, opcode::I_DEC, opcode::JMP_NZ) \
+	X(STOREW_STOREW, opcode::STORE_W, opcode::STORE_W) \
+	X(ICMPLE_JMPZ, opcode::I_CMP_LE, opcode::JMP_Z) \
+	X(LOADW_RJMP, opcode::LOAD_W, opcode::R_JMP) \
+	X(MOVW_IADD_NF, opcode::MOV_W, execop::I_ADD_NF) \
+	X(MOVW_IADD, opcode::MOV_W, opcode::I_ADD) \
+	X(LOADW_IDEC_STOREW_NF, opcode::LOAD_W, execop::I_DEC_NF, opcode::STORE_W) \
+	X(LOADW_IDEC_STOREW, opcode::LOAD_W, opcode::I_DEC, opcode::STORE_W)
+
+// Arithmetic that sets FZ from its result, each with a variant that leaves FZ alone (see Program::elideFlags)
+// X(op), giving execop op##_NF. Comparisons and the FLAG ops are left out, since setting FZ is all they do.
+#define EXEC_NO_FLAGS(X) \
+	X(I_INC) X(I_DEC) X(I_ADD) X(I_SUB) X(I_MUL) X(I_DIV) X(I_MOD) \
+	X(C_INC) X(C_DEC) X(C_ADD) X(C_SUB) X(C_MUL) X(C_DIV) X(C_MOD) \
+	X(F_ADD) X(F_SUB) X(F_MUL) X(F_DIV) X(F_MOD)
@@ -0,0 +1,843 @@
+#pragma once
+
+#include "executor.h"
+#include "scheduler.h"
+#include "snapshot.h"
+#include "lanes.h"
+#include <atomic>
+#include <limits>
+#include <math.h>
+#include <ctime>
+#include <stdexcept>
+
+// Opcode handlers, shared by every dispatch engine in executor.cpp
+// Each handler runs the decoded instruction at ip and returns the next instruction to run
+// Arithmetic handlers only set FZ with Flags, which their EXEC_NO_FLAGS variants turn off
+
+// Every handler except HALT, which each engine handles itself
+#define EXEC_OPCODES(X) \
+	X(NOP) X(BREAK) X(ALLOC) X(FREE) X(R_MOV_W) X(R_MOV_B) \
+	X(MOV_W) X(MOV_B) X(LOAD_W) X(STORE_W) X(LOAD_B) X(STORE_B) \
+	X(JMP) X(JMP_Z) X(JMP_NZ) X(R_JMP) X(R_JMP_Z) X(R_JMP_NZ) \
+	X(I_FLAG) X(I_CMP_EQ) X(I_CMP_NE) X(I_CMP_GT) X(I_CMP_LT) X(I_CMP_GE) \
+	X(I_CMP_LE) X(I_INC) X(I_DEC) X(I_ADD) X(I_SUB) X(I_MUL) \
+	X(I_DIV) X(I_MOD) X(I_TO_C) X(I_TO_F) X(C_FLAG) X(C_CMP_EQ) \
+	X(C_CMP_NE) X(C_CMP_GT) X(C_CMP_LT) X(C_CMP_GE) X(C_CMP_LE) X(C_INC) \
+	X(C_DEC) X(C_ADD) X(C_SUB) X(C_MUL) X(C_DIV) X(C_MOD) \
+	X(C_TO_I) X(C_TO_F) X(F_FLAG) X(F_CMP_EQ) X(F_CMP_NE) X(F_CMP_GT) \
+	X(F_CMP_LT) X(F_CMP_GE) X(F_CMP_LE) X(F_ADD) X(F_SUB) X(F_MUL) \
+	X(F_DIV) X(F_MOD) X(F_TO_C) X(F_TO_I) X(PRNT_C) X(PRNT_STR) \
+	X(READ_C) X(READ_STR) X(R_PRNT_I) X(R_PRNT_F) X(PRNT_LN) X(TIME) \
+	X(SPAWN) X(JOIN) X(YIELD) X(FLUSH) X(MEM_CPY) X(MEM_MOVE) \
+	X(MEM_SET) X(MEM_CMP) X(V_LOAD) X(V_STORE) X(V_SPLAT) X(VI_ADD) \
+	X(VI_SUB) X(VI_MUL) X(VI_DIV) X(VI_MIN) X(VI_MAX) X(VI_SUM) \
+	X(VF_ADD) X(VF_SUB) X(VF_MUL) X(VF_DIV) X(VF_MIN) X(VF_MAX) \
+	X(VF_SUM) X(STR_LEN) X(STR_CMP) X(STR_CHR) X(STR_CPY) X(LSTR_CMP) \
+	X(LSTR_CHR) X(LSTR_CPY) X(CALL) X(RET) X(BAD_OPCODE) X(BAD_REGISTER) \
+	X(SNAPSHOT)
+
+namespace vm {
+	namespace executor {
+		using namespace types;
+
+		// Held by console IO handlers while green threads run on more than one worker
+		class IoGuard {
+		public:
+			IoGuard(Machine& m) : lock(m.ioLock) {
+				if (lock != nullptr) lock->lock();
+			}
+
+			~IoGuard() {
+				if (lock != nullptr) lock->unlock();
+			}
+
+		private:
+			std::mutex* lock;
+		};
+
+		// Tells the StackTrap which instruction is about to access memory, before every access an opcode makes
+		// LOAD, STORE, their vector forms, CALL, RET, the bulk memory and string opcodes (whose library calls hold
+		// nothing), and PRNT_STR and READ_STR outside the IO lock pass themselves, so a fault there can be caught.
+		// Anything else passes nullptr, since leaving it early could skip a lock or a library call's cleanup: ALLOC and
+		// FREE, under the heap's lock, check the addresses they touch instead. Never cleared after, which would cost LOAD and STORE another
+		// store; the fence keeps the access itself from being moved before it, at no runtime cost.
+		inline void markAccess(Machine& m, const Instr* ip) {
+			m.trap.access = ip;
+			std::atomic_signal_fence(std::memory_order_seq_cst);
+		}
+
+		inline const Instr* op_NOP(Machine&, const Instr* ip) {
+			return ip + 1;
+		}
+
+		inline const Instr* op_BREAK(Machine& m, const Instr* ip) {
+			IoGuard io(m);
+			m.output->flush();
+			while (m.streamIn.get() != '\n');
+			return ip + 1;
+		}
+
+		inline const Instr* op_ALLOC(Machine& m, const Instr* ip) {
+			markAccess(m, nullptr);
+			try {
+				ip->a.word->word = m.heap->alloc(ip->b.word->word);
+			} catch (std::bad_alloc& e) {
+				throw ExecutorException(ExecutorException::BAD_ALLOC, ip[1].loc, e.what());
+			} catch (std::invalid_argument& e) {
+				throw ExecutorException(ExecutorException::BAD_ALLOC, ip[1].loc, e.what());
+			}
+			return ip + 1;
+		}
+
+		inline const Instr* op_FREE(Machine& m, const Instr* ip) {
+			markAccess(m, nullptr);
+			try {
+				m.heap->free(ip->a.word->word);
+			} catch (std::out_of_range& e) {
+				throw ExecutorException(ExecutorException::OUT_OF_BOUNDS, ip[1].loc, e.what());
+			} catch (std::invalid_argument& e) {
+				throw ExecutorException(ExecutorException::BAD_ALLOC, ip[1].loc, e.what());
+			}
+			return ip + 1;
+		}
+
+		inline const Instr* op_R_MOV_W(Machine&, const Instr* ip) {
+			*ip->a.word = *ip->b.word;
+			return ip + 1;
+		}
+
+		inline const Instr* op_R_MOV_B(Machine&, const Instr* ip) {
+			*ip->a.byte = *ip->b.byte;
+			return ip + 1;
+		}
+
+		inline const Instr* op_MOV_W(Machine&, const Instr* ip) {
+			ip->a.word->word = ip->imm;
+			return ip + 1;
+		}
+
+		inline const Instr* op_MOV_B(Machine&, const Instr* ip) {
+			ip->a.byte->byte = static_cast<byte_t>(ip->imm);
+			return ip + 1;
+		}
+
+		inline const Instr* op_LOAD_W(Machine& m, const Instr* ip) {
+			markAccess(m, ip);
+			ip->a.word->word = *reinterpret_cast<word_t*>(hostAddress(m.base, ip->b.word->word, ip->imm));
+			return ip + 1;
+		}
+
+		inline const Instr* op_STORE_W(Machine& m, const Instr* ip) {
+			markAccess(m, ip);
+			*reinterpret_cast<word_t*>(hostAddress(m.base, ip->a.word->word, ip->imm)) = ip->b.word->word;
+			return ip + 1;
+		}
+
+		inline const Instr* op_LOAD_B(Machine& m, const Instr* ip) {
+			markAccess(m, ip);
+			ip->a.byte->byte = *reinterpret_cast<byte_t*>(hostAddress(m.base, ip->b.word->word, ip->imm));
+			return ip + 1;
+		}
+
+		inline const Instr* op_STORE_B(Machine& m, const Instr* ip) {
+			markAccess(m, ip);
+			*reinterpret_cast<byte_t*>(hostAddress(m.base, ip->a.word->word, ip->imm)) = ip->b.byte->byte;
+			return ip + 1;
+		}
+
+		inline const Instr* op_JMP(Machine& m, const Instr* ip) {
+			return m.code + ip->target;
+		}
+
+		inline const Instr* op_JMP_Z(Machine& m, const Instr* ip) {
+			if (m.byteReg[register_::FZ].bool_) {
+				return ip + 1;
+			} else {
+				return m.code + ip->target;
+			}
+		}
+
+		inline const Instr* op_JMP_NZ(Machine& m, const Instr* ip) {
+			if (m.byteReg[register_::FZ].bool_) {
+				return m.code + ip->target;
+			} else {
+				return ip + 1;
+			}
+		}
+
+		inline const Instr* op_R_JMP(Machine& m, const Instr* ip) {
+			return m.program.jumpTarget(ip->a.word->word);
+		}
+
+		inline const Instr* op_R_JMP_Z(Machine& m, const Instr* ip) {
+			if (m.byteReg[register_::FZ].bool_ == 0) {
+				return ip + 1;
+			} else {
+				return m.program.jumpTarget(ip->a.word->word);
+			}
+		}
+
+		inline const Instr* op_R_JMP_NZ(Machine& m, const Instr* ip) {
+			if (m.byteReg[register_::FZ].bool_ == 0) {
+				return m.program.jumpTarget(ip->a.word->word);
+			} else {
+				return ip + 1;
+			}
+		}
+
+		// Frames are the ones programs build by hand (see the Sampler): the caller's BP at BP + 0, then the location to
+		// return to. Both only write BP once the frame is in memory, so a stack overflow can grow the stack and rerun them.
+		inline const Instr* op_CALL(Machine& m, const Instr* ip) {
+			markAccess(m, ip);
+			const word_t caller = m.wordReg[register_::BP].word;
+			const word_t frame = static_cast<word_t>(static_cast<uint32_t>(caller) + static_cast<uint32_t>(ip->imm));
+			word_t* saved = reinterpret_cast<word_t*>(hostAddress(m.base, frame));
+			saved[0] = caller;
+			saved[1] = ip[1].loc;
+			m.wordReg[register_::BP].word = frame;
+			m.returns.push(ip + 1, frame, caller);
+			return m.code + ip->target;
+		}
+
+		inline const Instr* op_RET(Machine& m, const Instr* ip) {
+			markAccess(m, ip);
+			const word_t frame = m.wordReg[register_::BP].word;
+			const word_t* saved = reinterpret_cast<const word_t*>(hostAddress(m.base, frame));
+			const word_t loc = saved[1];
+			m.wordReg[register_::BP].word = saved[0];
+			const Instr* predicted = m.returns.pop(frame, loc);
+			return predicted != nullptr ? predicted : m.program.jumpTarget(loc);
+		}
+
+		inline const Instr* op_I_FLAG(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.word->int_ == 0 ? 0 : 1;
+			// TODO : Set other flags if they exist?
+			return ip + 1;
+		}
+
+		inline const Instr* op_I_CMP_EQ(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.word->int_ == ip->b.word->int_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		inline const Instr* op_I_CMP_NE(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.word->int_ != ip->b.word->int_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		inline const Instr* op_I_CMP_GT(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.word->int_ > ip->b.word->int_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		inline const Instr* op_I_CMP_LT(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.word->int_ < ip->b.word->int_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		inline const Instr* op_I_CMP_GE(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.word->int_ >= ip->b.word->int_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		inline const Instr* op_I_CMP_LE(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.word->int_ <= ip->b.word->int_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_I_INC(Machine& m, const Instr* ip) {
+			ip->a.word->int_++;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.word->int_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_I_DEC(Machine& m, const Instr* ip) {
+			ip->a.word->int_--;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.word->int_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_I_ADD(Machine& m, const Instr* ip) {
+			ip->a.word->int_ = ip->b.word->int_ + ip->c.word->int_;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.word->int_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_I_SUB(Machine& m, const Instr* ip) {
+			ip->a.word->int_ = ip->b.word->int_ - ip->c.word->int_;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.word->int_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_I_MUL(Machine& m, const Instr* ip) {
+			ip->a.word->int_ = ip->b.word->int_ * ip->c.word->int_;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.word->int_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_I_DIV(Machine& m, const Instr* ip) {
+			if (ip->c.word->int_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, ip[1].loc);
+			ip->a.word->int_ = ip->b.word->int_ / ip->c.word->int_;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.word->int_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_I_MOD(Machine& m, const Instr* ip) {
+			if (ip->c.word->int_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, ip[1].loc);
+			ip->a.word->int_ = ip->b.word->int_ % ip->c.word->int_;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.word->int_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		inline const Instr* op_I_TO_C(Machine&, const Instr* ip) {
+			ip->a.byte->char_ = static_cast<char_t>(ip->b.word->int_);
+			return ip + 1;
+		}
+
+		inline const Instr* op_I_TO_F(Machine&, const Instr* ip) {
+			ip->a.word->float_ = static_cast<float_t>(ip->b.word->int_);
+			return ip + 1;
+		}
+
+		inline const Instr* op_C_FLAG(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.byte->char_ == 0 ? 0 : 1;
+			// TODO : Set other flags if they exist?
+			return ip + 1;
+		}
+
+		inline const Instr* op_C_CMP_EQ(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.byte->char_ == ip->b.byte->char_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		inline const Instr* op_C_CMP_NE(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.byte->char_ != ip->b.byte->char_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		inline const Instr* op_C_CMP_GT(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.byte->char_ > ip->b.byte->char_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		inline const Instr* op_C_CMP_LT(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.byte->char_ < ip->b.byte->char_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		inline const Instr* op_C_CMP_GE(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.byte->char_ >= ip->b.byte->char_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		inline const Instr* op_C_CMP_LE(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.byte->char_ <= ip->b.byte->char_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_C_INC(Machine& m, const Instr* ip) {
+			ip->a.byte->char_++;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.byte->char_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_C_DEC(Machine& m, const Instr* ip) {
+			ip->a.byte->char_--;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.byte->char_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_C_ADD(Machine& m, const Instr* ip) {
+			ip->a.byte->char_ = ip->b.byte->char_ + ip->c.byte->char_;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.byte->char_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_C_SUB(Machine& m, const Instr* ip) {
+			ip->a.byte->char_ = ip->b.byte->char_ - ip->c.byte->char_;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.byte->char_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_C_MUL(Machine& m, const Instr* ip) {
+			ip->a.byte->char_ = ip->b.byte->char_ * ip->c.byte->char_;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.byte->char_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_C_DIV(Machine& m, const Instr* ip) {
+			if (ip->c.byte->char_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, ip[1].loc);
+			ip->a.byte->char_ = ip->b.byte->char_ / ip->c.byte->char_;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.byte->char_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_C_MOD(Machine& m, const Instr* ip) {
+			if (ip->c.byte->char_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, ip[1].loc);
+			ip->a.byte->char_ = ip->b.byte->char_ % ip->c.byte->char_;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.byte->char_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		inline const Instr* op_C_TO_I(Machine&, const Instr* ip) {
+			ip->a.word->int_ = static_cast<char_t>(ip->b.byte->char_);
+			return ip + 1;
+		}
+
+		inline const Instr* op_C_TO_F(Machine&, const Instr* ip) {
+			ip->a.word->float_ = static_cast<float_t>(ip->b.byte->char_);
+			return ip + 1;
+		}
+
+		inline const Instr* op_F_FLAG(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.word->float_ == 0 ? 0 : 1;
+			// TODO : Set other flags if they exist?
+			return ip + 1;
+		}
+
+		inline const Instr* op_F_CMP_EQ(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.word->float_ == ip->b.word->float_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		inline const Instr* op_F_CMP_NE(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.word->float_ != ip->b.word->float_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		inline const Instr* op_F_CMP_GT(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.word->float_ > ip->b.word->float_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		inline const Instr* op_F_CMP_LT(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.word->float_ < ip->b.word->float_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		inline const Instr* op_F_CMP_GE(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.word->float_ >= ip->b.word->float_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		inline const Instr* op_F_CMP_LE(Machine& m, const Instr* ip) {
+			m.byteReg[register_::FZ].bool_ = ip->a.word->float_ <= ip->b.word->float_ ? 1 : 0;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_F_ADD(Machine& m, const Instr* ip) {
+			ip->a.word->float_ = ip->b.word->float_ + ip->c.word->float_;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.word->float_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_F_SUB(Machine& m, const Instr* ip) {
+			ip->a.word->float_ = ip->b.word->float_ - ip->c.word->float_;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.word->float_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_F_MUL(Machine& m, const Instr* ip) {
+			ip->a.word->float_ = ip->b.word->float_ * ip->c.word->float_;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.word->float_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_F_DIV(Machine& m, const Instr* ip) {
+			if (ip->c.word->float_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, ip[1].loc);
+			ip->a.word->float_ = ip->b.word->float_ / ip->c.word->float_;
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.word->float_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		template<bool Flags = true> inline const Instr* op_F_MOD(Machine& m, const Instr* ip) {
+			float_t float_;
+
+			if (ip->c.word->float_ == 0) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, ip[1].loc);
+			ip->a.word->float_ = ip->b.word->float_ * modf(ip->b.word->float_ / ip->c.word->float_, &float_);
+			if (Flags) m.byteReg[register_::FZ].bool_ = ip->a.word->float_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		inline const Instr* op_F_TO_C(Machine&, const Instr* ip) {
+			ip->a.byte->char_ = static_cast<char_t>(ip->b.word->float_);
+			return ip + 1;
+		}
+
+		inline const Instr* op_F_TO_I(Machine&, const Instr* ip) {
+			ip->a.word->int_ = static_cast<int_t>(ip->b.word->float_);
+			return ip + 1;
+		}
+
+		inline const Instr* op_PRNT_C(Machine& m, const Instr* ip) {
+			IoGuard io(m);
+			m.output->put(ip->a.byte->char_);
+			return ip + 1;
+		}
+
+		// Measured before taking the IO lock, so a string running out of bounds is caught like any other access
+		inline const Instr* op_PRNT_STR(Machine& m, const Instr* ip) {
+			markAccess(m, ip);
+			const char* str = hostAddress(m.base, ip->a.word->word, ip->imm);
+			const size_t length = std::strlen(str);
+			markAccess(m, nullptr);
+			IoGuard io(m);
+			m.output->write(str, length);
+			return ip + 1;
+		}
+
+		inline const Instr* op_READ_C(Machine& m, const Instr* ip) {
+			IoGuard io(m);
+			char rlchar;
+
+			m.output->flush();
+			m.streamIn.get(rlchar);
+			ip->a.byte->char_ = rlchar;
+			return ip + 1;
+		}
+
+		// Read under the IO lock, then copied into memory after it's released, for the same reason
+		inline const Instr* op_READ_STR(Machine& m, const Instr* ip) {
+			std::string line;
+			{
+				markAccess(m, nullptr);
+				IoGuard io(m);
+				m.output->flush();
+				std::getline(m.streamIn, line);
+			}
+			markAccess(m, ip);
+			std::memcpy(hostAddress(m.base, ip->a.word->word, ip->imm), line.c_str(), line.size() + 1);
+			return ip + 1;
+		}
+
+		inline const Instr* op_R_PRNT_I(Machine& m, const Instr* ip) {
+			IoGuard io(m);
+			m.output->writeInt(ip->a.word->int_);
+			return ip + 1;
+		}
+
+		inline const Instr* op_R_PRNT_F(Machine& m, const Instr* ip) {
+			IoGuard io(m);
+			m.output->writeFloat(ip->a.word->float_);
+			return ip + 1;
+		}
+
+		inline const Instr* op_PRNT_LN(Machine& m, const Instr* ip) {
+			IoGuard io(m);
+			m.output->put('\n');
+			return ip + 1;
+		}
+
+		inline const Instr* op_TIME(Machine&, const Instr* ip) {
+			ip->a.word->int_ = std::time(nullptr);
+			return ip + 1;
+		}
+
+		inline const Instr* op_FLUSH(Machine& m, const Instr* ip) {
+			IoGuard io(m);
+			m.output->flush();
+			return ip + 1;
+		}
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Bulk memory
+		// One host library call for a whole range, which is vectorized, instead of a LOAD_B/STORE_B loop dispatching
+		// several handlers per byte. Lengths that aren't positive do nothing.
+
+		// Host address of the length bytes at address
+		// The library calls may touch their ranges in any order, so with Z_SANDBOX a range must end inside the span:
+		// past it, the reservation's guard wouldn't stop them. Inside, the sandbox catches whatever it always does.
+		inline char* bulkAddress(Machine& m, const Instr* ip, word_t address, uint64_t length) {
+#if Z_SANDBOX
+			if (static_cast<uint32_t>(address) + length > Memory::SPAN) throw ExecutorException(ExecutorException::OUT_OF_BOUNDS, ip[1].loc);
+#endif
+			return hostAddress(m.base, address);
+		}
+
+		// The ranges mustn't overlap, see MEM_MOVE
+		inline const Instr* op_MEM_CPY(Machine& m, const Instr* ip) {
+			const int_t length = ip->c.word->int_;
+			if (length > 0) {
+				markAccess(m, ip);
+				std::memcpy(bulkAddress(m, ip, ip->a.word->word, length), bulkAddress(m, ip, ip->b.word->word, length), length);
+			}
+			return ip + 1;
+		}
+
+		inline const Instr* op_MEM_MOVE(Machine& m, const Instr* ip) {
+			const int_t length = ip->c.word->int_;
+			if (length > 0) {
+				markAccess(m, ip);
+				std::memmove(bulkAddress(m, ip, ip->a.word->word, length), bulkAddress(m, ip, ip->b.word->word, length), length);
+			}
+			return ip + 1;
+		}
+
+		inline const Instr* op_MEM_SET(Machine& m, const Instr* ip) {
+			const int_t length = ip->c.word->int_;
+			if (length > 0) {
+				markAccess(m, ip);
+				std::memset(bulkAddress(m, ip, ip->a.word->word, length), ip->b.byte->byte, length);
+			}
+			return ip + 1;
+		}
+
+		// Sets FZ to the sign of the first difference, so equal ranges set the zero flag
+		inline const Instr* op_MEM_CMP(Machine& m, const Instr* ip) {
+			const int_t length = ip->c.word->int_;
+			int result = 0;
+			if (length > 0) {
+				markAccess(m, ip);
+				result = std::memcmp(bulkAddress(m, ip, ip->a.word->word, length), bulkAddress(m, ip, ip->b.word->word, length), length);
+			}
+			m.byteReg[register_::FZ].char_ = result < 0 ? -1 : (result > 0 ? 1 : 0);
+			return ip + 1;
+		}
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Strings
+		// Null-terminated strings are scanned 16 bytes at a time (see lanes), and a scan that runs off the end of memory is
+		// caught like any other access. Length-prefixed strings (see GLOBAL_LSTR) are a word holding the length followed
+		// by the same null-terminated string, so their opcodes never scan, and work on strings with nulls in them.
+
+		inline const Instr* op_STR_LEN(Machine& m, const Instr* ip) {
+			markAccess(m, ip);
+			ip->a.word->int_ = static_cast<int_t>(lanes::length(hostAddress(m.base, ip->b.word->word)));
+			m.byteReg[register_::FZ].bool_ = ip->a.word->int_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		// Sets FZ like MEM_CMP
+		inline const Instr* op_STR_CMP(Machine& m, const Instr* ip) {
+			markAccess(m, ip);
+			const int result = lanes::compare(hostAddress(m.base, ip->a.word->word), hostAddress(m.base, ip->b.word->word));
+			m.byteReg[register_::FZ].char_ = result < 0 ? -1 : (result > 0 ? 1 : 0);
+			return ip + 1;
+		}
+
+		// The address of the first c, or 0 if there isn't one; looking for 0 finds the terminator
+		inline const Instr* op_STR_CHR(Machine& m, const Instr* ip) {
+			markAccess(m, ip);
+			const char c = ip->c.byte->byte;
+			const char* found = lanes::find(hostAddress(m.base, ip->b.word->word), c);
+			ip->a.word->word = *found == c ? wordAddress(m.base, found) : 0;
+			m.byteReg[register_::FZ].bool_ = ip->a.word->word == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		// The strings mustn't overlap, like MEM_CPY
+		inline const Instr* op_STR_CPY(Machine& m, const Instr* ip) {
+			markAccess(m, ip);
+			const char* from = hostAddress(m.base, ip->b.word->word);
+			const uint64_t size = lanes::length(from) + 1;
+			std::memcpy(bulkAddress(m, ip, ip->a.word->word, size), from, size);
+			return ip + 1;
+		}
+
+		// The size of the length-prefixed string at address, length, prefix and terminator included
+		inline uint64_t prefixedSize(Machine& m, word_t address) {
+			return static_cast<uint64_t>(*reinterpret_cast<uint32_t*>(hostAddress(m.base, address))) + sizeof(word_t) + 1;
+		}
+
+		// The address of its characters
+		inline word_t prefixedChars(word_t address) {
+			return static_cast<word_t>(static_cast<uint32_t>(address) + sizeof(word_t));
+		}
+
+		// Sets FZ like MEM_CMP, with a string that the other starts with ordered first
+		inline const Instr* op_LSTR_CMP(Machine& m, const Instr* ip) {
+			markAccess(m, ip);
+			const uint64_t sizeA = prefixedSize(m, ip->a.word->word);
+			const uint64_t sizeB = prefixedSize(m, ip->b.word->word);
+			const uint64_t shared = std::min(sizeA, sizeB) - sizeof(word_t) - 1;
+			int result = std::memcmp(bulkAddress(m, ip, prefixedChars(ip->a.word->word), shared), bulkAddress(m, ip, prefixedChars(ip->b.word->word), shared), shared);
+			if (result == 0) result = sizeA < sizeB ? -1 : (sizeA > sizeB ? 1 : 0);
+			m.byteReg[register_::FZ].char_ = result < 0 ? -1 : (result > 0 ? 1 : 0);
+			return ip + 1;
+		}
+
+		// Like STR_CHR, but only looks at the string's length, so never finds its terminator
+		inline const Instr* op_LSTR_CHR(Machine& m, const Instr* ip) {
+			markAccess(m, ip);
+			const uint64_t length = prefixedSize(m, ip->b.word->word) - sizeof(word_t) - 1;
+			const char* chars = bulkAddress(m, ip, prefixedChars(ip->b.word->word), length);
+			const void* found = std::memchr(chars, static_cast<unsigned char>(ip->c.byte->byte), length);
+			ip->a.word->word = found != nullptr ? wordAddress(m.base, static_cast<const char*>(found)) : 0;
+			m.byteReg[register_::FZ].bool_ = ip->a.word->word == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		// The strings mustn't overlap, like MEM_CPY
+		inline const Instr* op_LSTR_CPY(Machine& m, const Instr* ip) {
+			markAccess(m, ip);
+			const uint64_t size = prefixedSize(m, ip->b.word->word);
+			std::memcpy(bulkAddress(m, ip, ip->a.word->word, size), bulkAddress(m, ip, ip->b.word->word, size), size);
+			return ip + 1;
+		}
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Vectors
+		// Lane-wise over the vector registers, see lanes. These set no flags except the sums, which set them like the
+		// scalar opcodes do for their result.
+
+		inline const Instr* op_V_LOAD(Machine& m, const Instr* ip) {
+			markAccess(m, ip);
+			lanes::load(*ip->a.vec, hostAddress(m.base, ip->b.word->word, ip->imm));
+			return ip + 1;
+		}
+
+		inline const Instr* op_V_STORE(Machine& m, const Instr* ip) {
+			markAccess(m, ip);
+			lanes::store(hostAddress(m.base, ip->a.word->word, ip->imm), *ip->b.vec);
+			return ip + 1;
+		}
+
+		inline const Instr* op_V_SPLAT(Machine&, const Instr* ip) {
+			lanes::splat(*ip->a.vec, *ip->b.word);
+			return ip + 1;
+		}
+
+		inline const Instr* op_VI_ADD(Machine&, const Instr* ip) {
+			lanes::addI(*ip->a.vec, *ip->b.vec, *ip->c.vec);
+			return ip + 1;
+		}
+
+		inline const Instr* op_VI_SUB(Machine&, const Instr* ip) {
+			lanes::subI(*ip->a.vec, *ip->b.vec, *ip->c.vec);
+			return ip + 1;
+		}
+
+		inline const Instr* op_VI_MUL(Machine&, const Instr* ip) {
+			lanes::mulI(*ip->a.vec, *ip->b.vec, *ip->c.vec);
+			return ip + 1;
+		}
+
+		inline const Instr* op_VI_DIV(Machine&, const Instr* ip) {
+			if (lanes::anyZeroI(*ip->c.vec)) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, ip[1].loc);
+			lanes::divI(*ip->a.vec, *ip->b.vec, *ip->c.vec);
+			return ip + 1;
+		}
+
+		inline const Instr* op_VI_MIN(Machine&, const Instr* ip) {
+			lanes::minI(*ip->a.vec, *ip->b.vec, *ip->c.vec);
+			return ip + 1;
+		}
+
+		inline const Instr* op_VI_MAX(Machine&, const Instr* ip) {
+			lanes::maxI(*ip->a.vec, *ip->b.vec, *ip->c.vec);
+			return ip + 1;
+		}
+
+		inline const Instr* op_VI_SUM(Machine& m, const Instr* ip) {
+			ip->a.word->int_ = lanes::sumI(*ip->b.vec);
+			m.byteReg[register_::FZ].bool_ = ip->a.word->int_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		inline const Instr* op_VF_ADD(Machine&, const Instr* ip) {
+			lanes::addF(*ip->a.vec, *ip->b.vec, *ip->c.vec);
+			return ip + 1;
+		}
+
+		inline const Instr* op_VF_SUB(Machine&, const Instr* ip) {
+			lanes::subF(*ip->a.vec, *ip->b.vec, *ip->c.vec);
+			return ip + 1;
+		}
+
+		inline const Instr* op_VF_MUL(Machine&, const Instr* ip) {
+			lanes::mulF(*ip->a.vec, *ip->b.vec, *ip->c.vec);
+			return ip + 1;
+		}
+
+		inline const Instr* op_VF_DIV(Machine&, const Instr* ip) {
+			if (lanes::anyZeroF(*ip->c.vec)) throw ExecutorException(ExecutorException::DIVIDE_BY_ZERO, ip[1].loc);
+			lanes::divF(*ip->a.vec, *ip->b.vec, *ip->c.vec);
+			return ip + 1;
+		}
+
+		inline const Instr* op_VF_MIN(Machine&, const Instr* ip) {
+			lanes::minF(*ip->a.vec, *ip->b.vec, *ip->c.vec);
+			return ip + 1;
+		}
+
+		inline const Instr* op_VF_MAX(Machine&, const Instr* ip) {
+			lanes::maxF(*ip->a.vec, *ip->b.vec, *ip->c.vec);
+			return ip + 1;
+		}
+
+		inline const Instr* op_VF_SUM(Machine& m, const Instr* ip) {
+			ip->a.word->float_ = lanes::sumF(*ip->b.vec);
+			m.byteReg[register_::FZ].bool_ = ip->a.word->float_ == 0 ? 0 : 1;
+			return ip + 1;
+		}
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Green threads (see Scheduler)
+		// JOIN and YIELD may suspend the thread, in which case they return the HALT that hands this worker to another
+
+		inline const Instr* op_SPAWN(Machine& m, const Instr* ip) {
+			m.scheduler->spawn(m, ip);
+			return ip + 1;
+		}
+
+		inline const Instr* op_JOIN(Machine& m, const Instr* ip) {
+			return m.scheduler->join(m, ip);
+		}
+
+		inline const Instr* op_YIELD(Machine& m, const Instr* ip) {
+			return m.scheduler->yield(m, ip);
+		}
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Decoder placeholders (see execop)
+
+		inline const Instr* op_BAD_OPCODE(Machine&, const Instr* ip) {
+			throw ExecutorException(ExecutorException::UNKNOWN_OPCODE, ip->loc + 1);
+		}
+
+		inline const Instr* op_BAD_REGISTER(Machine&, const Instr* ip) {
+			throw ExecutorException(ExecutorException::INVALID_REGISTER, ip[1].loc);
+		}
+
+		inline const Instr* op_SNAPSHOT(Machine& m, const Instr* ip) {
+			return m.snapshot->take(m, ip);
+		}
+	
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Arithmetic that leaves FZ alone (see Program::elideFlags)
+
+#define NO_FLAGS_OP(op) inline const Instr* op_##op##_NF(Machine& m, const Instr* ip) { return op_##op<false>(m, ip); }
+		EXEC_NO_FLAGS(NO_FLAGS_OP)
+#undef NO_FLAGS_OP
+
+		// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+		// Superinstructions (see executorfusions.h)
+
+		// Both kinds of handler ID, so EXEC_OPCODES names can be qualified
+		namespace opids {
+			using namespace opcode;
+			using namespace execop;
+		}
+
+		template<int Op> const Instr* opAt(Machine& m, const Instr* ip);
+#define OP_AT(op) template<> inline const Instr* opAt<opids::op>(Machine& m, const Instr* ip) { return op_##op(m, ip); }
+#define NO_FLAGS_AT(op) OP_AT(op##_NF)
+		EXEC_OPCODES(OP_AT)
+		EXEC_NO_FLAGS(NO_FLAGS_AT)
+#undef NO_FLAGS_AT
+#undef OP_AT
+
+		// Runs each op of the sequence on its own record, exactly as the unfused handlers would
+		template<int Op> inline const Instr* fused(Machine& m, const Instr* ip) {
+			return opAt<Op>(m, ip);
+		}
+
+		template<int Op, int Next, int... Rest> inline const Instr* fused(Machine& m, const Instr* ip) {
+			return fused<Next, Rest...>(m, opAt<Op>(m, ip));
+		}
+
+#define FUSED_OP(op, ...) inline const Instr* op_##op(Machine& m, const Instr* ip) { return fused<__VA_ARGS__>(m, ip); }
+		EXEC_FUSIONS(FUSED_OP)
+#undef FUSED_OP
+	}
+}
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include "heap.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+using vm::executor::Heap;
+
+namespace {
+	constexpr size_t classSize(int sizeClass) {
+		return static_cast<size_t>(8) << sizeClass;
+	}
+}
+
+Heap::Heap(Memory& memoryIn) : shared(false), memory(memoryIn), mark(memoryIn.mark()), bump(nullptr), bumpEnd(nullptr), allocs(0), frees(0), liveBlocks(0), liveBytes(0), peakBytes(0), reservedBytes(0) {
+	std::fill(freeLists, freeLists + CLASS_COUNT, 0);
+}
+
+Heap::~Heap() {
+	memory.release(mark);
+}
+
+types::word_t Heap::alloc(types::word_t size) {
+	using namespace types;
+
+	if (size < 0) throw std::bad_array_new_length();
+
+	std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+	if (shared) guard.lock();
+
+	int sizeClass = 0;
+	while (classSize(sizeClass) < static_cast<size_t>(size)) sizeClass++;
+
+	word_t address = freeLists[sizeClass];
+	if (address != 0) {
+		if (!owns(address - sizeof(Header), sizeof(Header) + classSize(sizeClass))) throw std::invalid_argument("a freed block has been overwritten");
+		freeLists[sizeClass] = *reinterpret_cast<word_t*>(hostAddress(memory.base, address));
+	} else {
+		const size_t slot = sizeof(Header) + classSize(sizeClass);
+		char* block;
+		if (classSize(sizeClass) <= MAX_SMALL) {
+			// Whatever is left of the old chunk is too small for this class, and stays unused
+			if (static_cast<size_t>(bumpEnd - bump) < slot) {
+				bump = hostAddress(memory.base, memory.allocate(CHUNK_SIZE, false));
+				bumpEnd = bump + CHUNK_SIZE;
+				reservedBytes += CHUNK_SIZE;
+			}
+			block = bump;
+			bump += slot;
+		} else {
+			block = hostAddress(memory.base, memory.allocate(slot, false));
+			reservedBytes += slot;
+		}
+		address = wordAddress(memory.base, block + sizeof(Header));
+	}
+
+	Header& head = header(address);
+	head.sizeClass = sizeClass;
+	head.size = static_cast<uint32_t>(size);
+
+	allocs++;
+	liveBlocks++;
+	liveBytes += size;
+	peakBytes = std::max(peakBytes, liveBytes);
+	return address;
+}
+
+void Heap::free(types::word_t address) {
+	if (address == 0) return;
+
+	std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+	if (shared) guard.lock();
+
+	if (!owns(address - sizeof(Header), sizeof(Header) + sizeof(types::word_t))) throw std::out_of_range("address " + std::to_string(static_cast<uint32_t>(address)) + " was never allocated");
+
+	Header& head = header(address);
+	if (head.sizeClass >= CLASS_COUNT) throw std::invalid_argument("the header before the freed block has been overwritten");
+	if (head.size == FREED) throw std::invalid_argument("the block has already been freed");
+	frees++;
+	liveBlocks--;
+	liveBytes -= head.size;
+	head.size = FREED;
+
+	*reinterpret_cast<types::word_t*>(hostAddress(memory.base, address)) = freeLists[head.sizeClass];
+	freeLists[head.sizeClass] = address;
+}
+
+void Heap::report(std::ostream& stream) const {
+	// Rounding up to size classes, free blocks waiting for reuse and the unused ends of chunks
+	const double fragmentation = reservedBytes > 0 ? 100.0 * (reservedBytes - liveBytes) / reservedBytes : 0;
+
+	stream << IO_PROFILE "Heap: " << allocs << " allocations, " << frees << " frees, " << liveBlocks << " blocks still live at exit\n";
+	stream << "[PROFILE] Heap bytes: " << liveBytes << " live at exit, " << peakBytes << " peak, " << reservedBytes << " reserved from the host ("
+		<< std::fixed << std::setprecision(1) << fragmentation << "% unused)" IO_NORM "\n";
+	stream << std::defaultfloat << std::setprecision(6);
+}
+
+Heap::State Heap::save() const {
+	State state;
+	std::copy(freeLists, freeLists + CLASS_COUNT, state.freeLists);
+	state.bump = bump == nullptr ? 0 : wordAddress(memory.base, bump);
+	state.bumpEnd = bumpEnd == nullptr ? 0 : wordAddress(memory.base, bumpEnd);
+	state.allocs = allocs;
+	state.frees = frees;
+	state.liveBlocks = liveBlocks;
+	state.liveBytes = liveBytes;
+	state.peakBytes = peakBytes;
+	state.reservedBytes = reservedBytes;
+	return state;
+}
+
+void Heap::restore(const State& state) {
+	std::copy(state.freeLists, state.freeLists + CLASS_COUNT, freeLists);
+	bump = state.bump == 0 ? nullptr : hostAddress(memory.base, state.bump);
+	bumpEnd = state.bumpEnd == 0 ? nullptr : hostAddress(memory.base, state.bumpEnd);
+	allocs = state.allocs;
+	frees = state.frees;
+	liveBlocks = state.liveBlocks;
+	liveBytes = state.liveBytes;
+	peakBytes = state.peakBytes;
+	reservedBytes = state.reservedBytes;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+Heap::Header& Heap::header(types::word_t address) {
+	return *reinterpret_cast<Header*>(hostAddress(memory.base, address, -static_cast<types::word_t>(sizeof(Header))));
+}
+
+bool Heap::owns(types::word_t address, size_t size) const {
+#if Z_SANDBOX
+	const uint64_t from = static_cast<uint32_t>(address);
+	const std::vector<Memory::Region>& regions = memory.regions();
+	auto after = std::upper_bound(regions.begin(), regions.end(), from, [](uint64_t at, const Memory::Region& region) {
+		return at < region.offset;
+	});
+	if (after == regions.begin()) return false;
+	const Memory::Region& region = *std::prev(after);
+	return region.offset >= mark && from + size <= region.offset + static_cast<uint64_t>(region.size);
+#else
+	// Addresses are the host's, with nothing to check them against
+	return true;
+#endif
+}
\ No newline at end of file
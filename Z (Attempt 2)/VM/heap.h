@@ -0,0 +1,85 @@
+#pragma once
+
+#include "memory.h"
+#include <mutex>
+#include <ostream>
+
+namespace vm {
+	namespace executor {
+		// Memory handed out by ALLOC and taken back by FREE, owned by one execution
+		// Blocks are rounded up to a power-of-two size class, and freed ones go on their class's free list for the next
+		// ALLOC of that size. Small classes are carved by bumping through CHUNK_SIZE chunks, and bigger ones get a region
+		// of their own, all from the program's Memory. Every block has a Header just before it, so FREE needs nothing but
+		// the address.
+		// Whatever the program never freed is released in bulk with the heap, when exec_ returns or throws.
+		class Heap {
+		public:
+			static constexpr int CLASS_COUNT = 29;			// 8 bytes up to 2GB
+			static constexpr size_t MAX_SMALL = 0x800;
+			static constexpr size_t CHUNK_SIZE = 0x10000;
+
+			// Set before a second worker can reach ALLOC or FREE, after which every call takes the lock
+			bool shared;
+
+			Heap(Memory& memoryIn);
+			~Heap();
+
+			// Returns the word address of the block
+			// Throws std::bad_alloc (std::bad_array_new_length for a negative size), like new char[]
+			// Freed blocks are in program memory, so throws std::invalid_argument when the one to reuse says its
+			// successor on the free list is outside the heap
+			types::word_t alloc(types::word_t size);
+			// Does nothing for 0, like delete[] with nullptr
+			// Throws std::out_of_range for an address whose header isn't in the heap. The header is in program memory, so
+			// throws std::invalid_argument when it holds no size class, or says the block was already freed
+			void free(types::word_t address);
+
+			// Allocation counts and byte totals, for -profile
+			void report(std::ostream& stream) const;
+
+			// Everything but the blocks, which a snapshot keeps in the Memory they're in
+			struct State {
+				types::word_t freeLists[CLASS_COUNT];
+				types::word_t bump;		// Word addresses, 0 without a chunk
+				types::word_t bumpEnd;
+				uint64_t allocs;
+				uint64_t frees;
+				uint64_t liveBlocks;
+				uint64_t liveBytes;
+				uint64_t peakBytes;
+				uint64_t reservedBytes;
+			};
+
+			State save() const;
+			// Only for a heap on the restored Memory the state came from
+			void restore(const State& state);
+
+		private:
+			struct Header {
+				uint32_t sizeClass;
+				uint32_t size;		// As requested, or FREED once it's on a free list
+			};
+
+			static constexpr uint32_t FREED = 0xffffffffu;		// More than any word can ask for
+
+			Memory& memory;
+			size_t mark;
+			std::mutex lock;
+			char* bump;
+			char* bumpEnd;
+			types::word_t freeLists[CLASS_COUNT];	// Each free block holds the next one's address, 0 at the end
+
+			uint64_t allocs;
+			uint64_t frees;
+			uint64_t liveBlocks;
+			uint64_t liveBytes;		// As requested
+			uint64_t peakBytes;
+			uint64_t reservedBytes;	// Taken from the Memory, by chunks and large blocks
+
+			Header& header(types::word_t address);
+			// Whether the size bytes at address are all in one region the heap took from the Memory, so touching them
+			// can't fault
+			bool owns(types::word_t address, size_t size) const;
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,713 @@
+#include "jit.h"
+#include "executorops.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#if Z_HAS_JIT
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+using vm::executor::Jit;
+using vm::executor::Instr;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// x86-64 encoding
+//
+// Native code takes no arguments and returns the instruction to continue interpreting from:
+//   r8  = &wordReg[0]
+//   r9  = &byteReg[0]
+//   r15 = Machine::base, saved on entry
+//   rax, rcx, rdx, xmm0, xmm1 = scratch
+// Regions keep every register in memory. Traces keep the word registers they use most in host registers for the
+// whole loop (saving any that are callee-saved in either ABI), and write them back on every exit, so any exit leaves
+// the machine exactly as the interpreter expects.
+
+namespace {
+	using namespace vm::executor;
+	using namespace types;
+
+	// Condition codes, as used by jcc/setcc
+	enum Cond : uint8_t {
+		CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7,
+		CC_P = 0xA, CC_NP = 0xB, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+	};
+
+	constexpr uint8_t NO_HOST = 0xFF;
+
+	// Host registers traces cache word registers in, in order of preference: rsi, rdi, r10, r11, rbx, r12, r13, r14
+	constexpr uint8_t HOST_REGS[] = { 6, 7, 10, 11, 3, 12, 13, 14 };
+
+	bool isCalleeSaved(uint8_t reg) {
+		return reg == 3 || reg == 6 || reg == 7 || reg >= 12;
+	}
+
+	class Emitter {
+	public:
+		std::vector<uint8_t> out;
+		std::vector<std::pair<size_t, const Instr*>> accesses;	// Where each memory access starts in out, see Jit::accessAt
+
+		Emitter(const Machine& m) : m(m) {
+			std::fill(std::begin(host), std::end(host), NO_HOST);
+		}
+
+		void byte(uint8_t b) {
+			out.push_back(b);
+		}
+
+		void bytes(std::initializer_list<uint8_t> bs) {
+			out.insert(out.end(), bs.begin(), bs.end());
+		}
+
+		void imm32(uint32_t v) {
+			for (int i = 0; i < 4; i++) byte(static_cast<uint8_t>(v >> (8 * i)));
+		}
+
+		void imm64(uint64_t v) {
+			for (int i = 0; i < 8; i++) byte(static_cast<uint8_t>(v >> (8 * i)));
+		}
+
+		// Register file indices of operands
+		int w(const Operand& o) const {
+			return static_cast<int>(o.word - m.wordReg);
+		}
+
+		int b(const Operand& o) const {
+			return static_cast<int>(o.byte - m.byteReg);
+		}
+
+		// Keeps word register idx in a host register from the prologue to every exit
+		void cache(int idx, uint8_t reg) {
+			host[idx] = reg;
+			cached.push_back(idx);
+		}
+
+		// op with reg in ModRM.reg and word register idx as r/m: the host register caching it, or [r8 + disp8]
+		// A mandatory prefix (66/F3) has to come before REX, so it's passed separately
+		void wordRm(std::initializer_list<uint8_t> opcode, uint8_t reg, int idx, uint8_t prefix = 0) {
+			if (prefix != 0) byte(prefix);
+			const uint8_t rexR = (reg & 8) >> 1;
+			if (host[idx] != NO_HOST) {
+				const uint8_t rm = host[idx];
+				if (rexR | (rm >> 3)) byte(0x40 | rexR | (rm >> 3));
+				bytes(opcode);
+				byte(static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+			} else {
+				byte(0x41 | rexR);
+				bytes(opcode);
+				bytes({ static_cast<uint8_t>(0x40 | ((reg & 7) << 3)), static_cast<uint8_t>(idx * sizeof(WordVal)) });
+			}
+		}
+
+		// op with reg in ModRM.reg and [r9 + byte register idx] as r/m
+		void byteRm(std::initializer_list<uint8_t> opcode, uint8_t reg, int idx) {
+			byte(0x41);
+			bytes(opcode);
+			bytes({ static_cast<uint8_t>(0x41 | (reg << 3)), static_cast<uint8_t>(idx) });
+		}
+
+		void loadWord(uint8_t reg, int idx) { wordRm({ 0x8B }, reg, idx); }
+		void storeWord(uint8_t reg, int idx) { wordRm({ 0x89 }, reg, idx); }
+		void loadByte(uint8_t reg, int idx) { byteRm({ 0x8A }, reg, idx); }
+		void storeByte(uint8_t reg, int idx) { byteRm({ 0x88 }, reg, idx); }
+
+		// movd for cached registers, movss for ones in memory
+		void loadFloat(uint8_t xmm, int idx) {
+			if (host[idx] != NO_HOST) {
+				wordRm({ 0x0F, 0x6E }, xmm, idx, 0x66);
+			} else {
+				wordRm({ 0x0F, 0x10 }, xmm, idx, 0xF3);
+			}
+		}
+
+		void storeFloat(uint8_t xmm, int idx) {
+			if (host[idx] != NO_HOST) {
+				wordRm({ 0x0F, 0x7E }, xmm, idx, 0x66);
+			} else {
+				wordRm({ 0x0F, 0x11 }, xmm, idx, 0xF3);
+			}
+		}
+
+		// FZ = cond ? 1 : 0, from the current flags
+		void setFlag(Cond cond) {
+			bytes({ 0x0F, static_cast<uint8_t>(0x90 | cond), 0xC0 }); // setcc al
+			storeByte(0, register_::FZ);
+		}
+
+		// FZ = xmm0 == 0 ? 0 : 1, where NaN counts as non-zero like in C++
+		void setFlagFromFloat() {
+			bytes({ 0x0F, 0x57, 0xC9 });			// xorps xmm1, xmm1
+			bytes({ 0x0F, 0x2E, 0xC1 });			// ucomiss xmm0, xmm1
+			bytes({ 0x0F, 0x95, 0xC0 });			// setne al
+			bytes({ 0x0F, 0x9A, 0xC1 });			// setp cl
+			bytes({ 0x08, 0xC8 });					// or al, cl
+			storeByte(0, register_::FZ);
+		}
+
+		// cmp byte [r9 + FZ], 0
+		void testFlag() {
+			byteRm({ 0x80 }, 7, register_::FZ);
+			byte(0);
+		}
+
+		// rax = host address of (base + imm), wrapping to 32 bits like hostAddress does
+		void address(int base, word_t imm) {
+			loadWord(0, base);
+			byte(0x05); imm32(static_cast<uint32_t>(imm));	// add eax, imm32, which clears the top of rax
+			bytes({ 0x4C, 0x01, 0xF8 });					// add rax, r15
+		}
+
+		void prologue() {
+			for (const int& idx : cached) {
+				if (isCalleeSaved(host[idx])) push(host[idx]);
+			}
+			bytes({ 0x49, 0xB8 }); imm64(reinterpret_cast<uint64_t>(m.wordReg)); // mov r8, imm64
+			bytes({ 0x49, 0xB9 }); imm64(reinterpret_cast<uint64_t>(m.byteReg)); // mov r9, imm64
+			push(15);
+			bytes({ 0x49, 0xBF }); imm64(reinterpret_cast<uint64_t>(m.base)); // mov r15, imm64
+			for (const int& idx : cached) hostMove(0x8B, idx);
+		}
+
+		void exitTo(const Instr* ip) {
+			for (const int& idx : cached) hostMove(0x89, idx);
+			pop(15);
+			for (size_t i = cached.size(); i-- > 0;) {
+				if (isCalleeSaved(host[cached[i]])) pop(host[cached[i]]);
+			}
+			bytes({ 0x48, 0xB8 }); imm64(reinterpret_cast<uint64_t>(ip)); // mov rax, imm64
+			byte(0xC3); // ret
+		}
+
+		// Leaves for the interpreter at ip when cond holds
+		void exitIf(Cond cond, const Instr* ip) {
+			bytes({ static_cast<uint8_t>(0x70 | (cond ^ 1)), 0 }); // short jump over the exit on the opposite condition
+			const size_t from = out.size();
+			exitTo(ip);
+			out[from - 1] = static_cast<uint8_t>(out.size() - from);
+		}
+
+		// Returns where the rel32 goes, for patching once the target is placed
+		size_t jump(int cond) {
+			if (cond < 0) {
+				byte(0xE9);
+			} else {
+				bytes({ 0x0F, static_cast<uint8_t>(0x80 | cond) });
+			}
+			imm32(0);
+			return out.size() - 4;
+		}
+
+		// Everything except jumps, which regions and traces place differently
+		void translate(const Instr& in);
+
+	private:
+		const Machine& m;
+		uint8_t host[register_::COUNT];
+		std::vector<int> cached;
+
+		void push(uint8_t reg) {
+			if (reg >= 8) byte(0x41);
+			byte(static_cast<uint8_t>(0x50 | (reg & 7)));
+		}
+
+		void pop(uint8_t reg) {
+			if (reg >= 8) byte(0x41);
+			byte(static_cast<uint8_t>(0x58 | (reg & 7)));
+		}
+
+		// mov between a cached register's host register and its slot in wordReg
+		void hostMove(uint8_t opcode, int idx) {
+			const uint8_t reg = host[idx];
+			bytes({ static_cast<uint8_t>(0x41 | ((reg & 8) >> 1)), opcode });
+			bytes({ static_cast<uint8_t>(0x40 | ((reg & 7) << 3)), static_cast<uint8_t>(idx * sizeof(WordVal)) });
+		}
+	};
+
+	void Emitter::translate(const Instr& in) {
+		using namespace opcode;
+
+		switch (in.op) {
+			case NOP:
+				break;
+
+			case R_MOV_W:
+				loadWord(0, w(in.b));
+				storeWord(0, w(in.a));
+				break;
+
+			case R_MOV_B:
+				loadByte(0, b(in.b));
+				storeByte(0, b(in.a));
+				break;
+
+			case MOV_W:
+				wordRm({ 0xC7 }, 0, w(in.a)); imm32(static_cast<uint32_t>(in.imm));
+				break;
+
+			case MOV_B:
+				byteRm({ 0xC6 }, 0, b(in.a)); byte(static_cast<uint8_t>(in.imm));
+				break;
+
+			case LOAD_W:
+				accesses.push_back(std::make_pair(out.size(), &in));
+				address(w(in.b), in.imm);
+				bytes({ 0x8B, 0x08 });				// mov ecx, [rax]
+				storeWord(1, w(in.a));
+				break;
+
+			case STORE_W:
+				accesses.push_back(std::make_pair(out.size(), &in));
+				address(w(in.a), in.imm);
+				loadWord(1, w(in.b));
+				bytes({ 0x89, 0x08 });				// mov [rax], ecx
+				break;
+
+			case LOAD_B:
+				accesses.push_back(std::make_pair(out.size(), &in));
+				address(w(in.b), in.imm);
+				bytes({ 0x8A, 0x08 });				// mov cl, [rax]
+				storeByte(1, b(in.a));
+				break;
+
+			case STORE_B:
+				accesses.push_back(std::make_pair(out.size(), &in));
+				address(w(in.a), in.imm);
+				loadByte(1, b(in.b));
+				bytes({ 0x88, 0x08 });				// mov [rax], cl
+				break;
+
+			case I_FLAG:
+				wordRm({ 0x83 }, 7, w(in.a)); byte(0); // cmp a, 0
+				setFlag(CC_NE);
+				break;
+
+			case I_CMP_EQ: case I_CMP_NE: case I_CMP_GT: case I_CMP_LT: case I_CMP_GE: case I_CMP_LE: {
+				static constexpr Cond conds[] = { CC_E, CC_NE, CC_G, CC_L, CC_GE, CC_LE };
+				loadWord(0, w(in.a));
+				wordRm({ 0x3B }, 0, w(in.b));		// cmp eax, b
+				setFlag(conds[in.op - I_CMP_EQ]);
+				break;
+			}
+
+			case I_INC:
+			case I_DEC:
+				wordRm({ 0xFF }, in.op == I_INC ? 0 : 1, w(in.a)); // inc/dec a
+				setFlag(CC_NE);
+				break;
+
+			case I_ADD:
+			case I_SUB:
+			case I_MUL:
+				loadWord(0, w(in.b));
+				if (in.op == I_MUL) {
+					wordRm({ 0x0F, 0xAF }, 0, w(in.c)); // imul eax, c
+				} else {
+					wordRm({ static_cast<uint8_t>(in.op == I_ADD ? 0x03 : 0x2B) }, 0, w(in.c));
+				}
+				storeWord(0, w(in.a));
+				bytes({ 0x85, 0xC0 });				// test eax, eax
+				setFlag(CC_NE);
+				break;
+
+			case I_DIV:
+			case I_MOD:
+				loadWord(1, w(in.c));
+				bytes({ 0x85, 0xC9 });				// test ecx, ecx
+				exitIf(CC_E, &in);					// Divide by zero: let the interpreter throw
+				loadWord(0, w(in.b));
+				byte(0x99);							// cdq
+				bytes({ 0xF7, 0xF9 });				// idiv ecx
+				if (in.op == I_DIV) {
+					storeWord(0, w(in.a));
+					bytes({ 0x85, 0xC0 });			// test eax, eax
+				} else {
+					storeWord(2, w(in.a));
+					bytes({ 0x85, 0xD2 });			// test edx, edx
+				}
+				setFlag(CC_NE);
+				break;
+
+			case I_TO_F:
+				bytes({ 0x0F, 0x57, 0xC0 });		// xorps xmm0, xmm0, so cvtsi2ss doesn't wait on the old value
+				wordRm({ 0x0F, 0x2A }, 0, w(in.b), 0xF3); // cvtsi2ss xmm0, b
+				storeFloat(0, w(in.a));
+				break;
+
+			case F_CMP_EQ: case F_CMP_NE: case F_CMP_GT: case F_CMP_LT: case F_CMP_GE: case F_CMP_LE: {
+				// a < b and a <= b compare the other way round, so unordered (NaN) always comes out false
+				const bool swap = in.op == F_CMP_LT || in.op == F_CMP_LE;
+				loadFloat(0, w(swap ? in.b : in.a));
+				loadFloat(1, w(swap ? in.a : in.b));
+				bytes({ 0x0F, 0x2E, 0xC1 });		// ucomiss xmm0, xmm1
+
+				if (in.op == F_CMP_EQ || in.op == F_CMP_NE) {
+					const bool eq = in.op == F_CMP_EQ;
+					bytes({ 0x0F, static_cast<uint8_t>(0x90 | (eq ? CC_E : CC_NE)), 0xC0 });		// setcc al
+					bytes({ 0x0F, static_cast<uint8_t>(0x90 | (eq ? CC_NP : CC_P)), 0xC1 });		// setcc cl
+					bytes({ static_cast<uint8_t>(eq ? 0x20 : 0x08), 0xC8 });						// and/or al, cl
+					storeByte(0, register_::FZ);
+				} else {
+					setFlag(in.op == F_CMP_GT || in.op == F_CMP_LT ? CC_A : CC_AE);
+				}
+				break;
+			}
+
+			case F_ADD:
+			case F_SUB:
+			case F_MUL:
+			case F_DIV: {
+				static constexpr uint8_t ops[] = { 0x58, 0x5C, 0x59, 0x5E };
+				if (in.op == F_DIV) {
+					loadWord(1, w(in.c));
+					bytes({ 0x01, 0xC9 });			// add ecx, ecx: zero for +0.0 and -0.0 only
+					exitIf(CC_E, &in);
+				}
+				loadFloat(0, w(in.b));
+				loadFloat(1, w(in.c));
+				bytes({ 0xF3, 0x0F, ops[in.op - F_ADD], 0xC1 });	// op xmm0, xmm1
+				storeFloat(0, w(in.a));
+				setFlagFromFloat();
+				break;
+			}
+		}
+	}
+
+	bool isSupported(int op) {
+		using namespace opcode;
+
+		switch (op) {
+			case NOP:
+			case R_MOV_W: case R_MOV_B: case MOV_W: case MOV_B:
+			case LOAD_W: case STORE_W: case LOAD_B: case STORE_B:
+			case JMP: case JMP_Z: case JMP_NZ:
+			case I_FLAG: case I_CMP_EQ: case I_CMP_NE: case I_CMP_GT: case I_CMP_LT: case I_CMP_GE: case I_CMP_LE:
+			case I_INC: case I_DEC: case I_ADD: case I_SUB: case I_MUL: case I_DIV: case I_MOD: case I_TO_F:
+			case F_CMP_EQ: case F_CMP_NE: case F_CMP_GT: case F_CMP_LT: case F_CMP_GE: case F_CMP_LE:
+			case F_ADD: case F_SUB: case F_MUL: case F_DIV:
+				return true;
+
+			default:
+				return false;
+		}
+	}
+
+	// Word register operands of a supported instruction, for choosing what a trace keeps in host registers
+	int wordOperands(const Instr& in, const Operand* (&out)[3]) {
+		using namespace opcode;
+
+		switch (in.op) {
+			case MOV_W: case I_FLAG: case I_INC: case I_DEC: case STORE_B:
+				out[0] = &in.a;
+				return 1;
+
+			case LOAD_B:
+				out[0] = &in.b;
+				return 1;
+
+			case R_MOV_W: case LOAD_W: case STORE_W: case I_TO_F:
+			case I_CMP_EQ: case I_CMP_NE: case I_CMP_GT: case I_CMP_LT: case I_CMP_GE: case I_CMP_LE:
+			case F_CMP_EQ: case F_CMP_NE: case F_CMP_GT: case F_CMP_LT: case F_CMP_GE: case F_CMP_LE:
+				out[0] = &in.a;
+				out[1] = &in.b;
+				return 2;
+
+			case I_ADD: case I_SUB: case I_MUL: case I_DIV: case I_MOD:
+			case F_ADD: case F_SUB: case F_MUL: case F_DIV:
+				out[0] = &in.a;
+				out[1] = &in.b;
+				out[2] = &in.c;
+				return 3;
+
+			default:
+				return 0;
+		}
+	}
+
+	// Runs one supported instruction the way the interpreter would, for recording traces
+	const Instr* step(Machine& m, const Instr* ip) {
+		using namespace opcode;
+		using namespace execop;
+
+		switch (ip->op) {
+#define STEP_OP(op) case op: return op_##op(m, ip);
+			EXEC_OPCODES(STEP_OP)
+#undef STEP_OP
+			default:
+				return ip;
+		}
+	}
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+Jit::Jit() : machine(nullptr), codeStart(nullptr), codeUsed(0), regionCount(0), traceCount(0) {}
+
+Jit::~Jit() {
+#if Z_HAS_JIT
+	if (codeStart != nullptr) {
+#ifdef _WIN32
+		VirtualFree(codeStart, 0, MEM_RELEASE);
+#else
+		munmap(codeStart, CODE_SIZE);
+#endif
+	}
+#endif
+}
+
+bool Jit::start(Machine& m) {
+#if Z_HAS_JIT
+	machine = &m;
+	heat.assign(m.program.instrs.capacity(), 0);
+	native.assign(m.program.instrs.capacity(), nullptr);
+
+#ifdef _WIN32
+	codeStart = static_cast<char*>(VirtualAlloc(nullptr, CODE_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+#else
+	void* mapped = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	codeStart = mapped == MAP_FAILED ? nullptr : static_cast<char*>(mapped);
+#endif
+	if (codeStart == nullptr) return false;
+	m.trap.nativeStart = codeStart;
+	m.trap.nativeEnd = codeStart + CODE_SIZE;
+	return writable(false);
+#else
+	return false;
+#endif
+}
+
+// Code is never writable and executable at once
+bool Jit::writable(bool on) {
+#if Z_HAS_JIT
+#ifdef _WIN32
+	DWORD old;
+	return VirtualProtect(codeStart, CODE_SIZE, on ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old) != 0;
+#else
+	return mprotect(codeStart, CODE_SIZE, on ? (PROT_READ | PROT_WRITE) : (PROT_READ | PROT_EXEC)) == 0;
+#endif
+#else
+	return false;
+#endif
+}
+
+// Compiled code only ever goes after what's already there, so accesses stays sorted
+const Instr* Jit::accessAt(const void* pc) const {
+	const char* const at = static_cast<const char*>(pc);
+	if (at == nullptr || at < codeStart || at >= codeStart + codeUsed) return nullptr;
+
+	auto after = std::upper_bound(accesses.begin(), accesses.end(), at, [](const char* at, const std::pair<const char*, const Instr*>& access) {
+		return at < access.first;
+	});
+	return after == accesses.begin() ? nullptr : std::prev(after)->second;
+}
+
+int Jit::regions() const {
+	return regionCount;
+}
+
+int Jit::traces() const {
+	return traceCount;
+}
+
+const Instr* Jit::enter(const Instr* from, const Instr* ip) {
+	using namespace opcode;
+
+	if (codeStart == nullptr) return ip;
+
+	while (true) {
+		const size_t index = ip - machine->code;
+		NativeRegion region = native[index];
+
+		if (region == nullptr) {
+			if (heat[index] == THRESHOLD) return ip; // Already tried and couldn't compile
+			if (++heat[index] < THRESHOLD) return ip;
+
+			// Loop heads get a trace of the path actually taken around the loop, falling back to a region
+			if (from != nullptr && (from->op == JMP_Z || from->op == JMP_NZ) && ip->loc <= from->loc) {
+				std::vector<TraceStep> trace;
+				const Instr* stopped = record(index, trace);
+				if (!trace.empty()) compileTrace(trace);
+				if (native[index] == nullptr) compile(index);
+				if (stopped != ip) return stopped;
+				region = native[index];
+			} else {
+				region = compile(index);
+			}
+			if (region == nullptr) return ip;
+		}
+
+		const Instr* next = region();
+		// Stopped before its own first instruction, which the interpreter has to run (and may throw from)
+		if (next == ip) return ip;
+		ip = next;
+		from = nullptr;
+	}
+}
+
+// Interprets one trip around the loop from head, noting the path and which way each conditional jump went
+// Returns where interpreting stopped: head if the loop closed, leaving the trace in trace, otherwise with trace empty
+const Instr* Jit::record(size_t head, std::vector<TraceStep>& trace) {
+	Machine& m = *machine;
+	const Instr* const start = m.code + head;
+	std::vector<bool> seen(m.program.instrs.size(), false);
+
+	const Instr* ip = start;
+	do {
+		const size_t index = ip - m.code;
+		// Inner loops get their own traces, and anything else ends the recording where the interpreter can pick up
+		if (!isSupported(ip->op) || seen[index] || trace.size() >= MAX_TRACE) {
+			trace.clear();
+			return ip;
+		}
+		seen[index] = true;
+
+		const Instr* next = step(m, ip);
+		trace.push_back({ index, next != ip + 1 });
+		ip = next;
+	} while (ip != start);
+
+	return ip;
+}
+
+Jit::NativeRegion Jit::compileTrace(const std::vector<TraceStep>& trace) {
+	using namespace opcode;
+
+	const Machine& m = *machine;
+	const std::vector<Instr>& instrs = m.program.instrs;
+	const Instr* const code = m.code;
+
+	Emitter e(m);
+
+	// The most used word registers stay in host registers around the loop
+	int uses[register_::COUNT] = {};
+	for (const TraceStep& step : trace) {
+		const Operand* operands[3];
+		const int count = wordOperands(instrs[step.index], operands);
+		for (int i = 0; i < count; i++) uses[e.w(*operands[i])]++;
+	}
+
+	int order[register_::COUNT];
+	for (int i = 0; i < register_::COUNT; i++) order[i] = i;
+	std::stable_sort(std::begin(order), std::end(order), [&uses](int a, int b) { return uses[a] > uses[b]; });
+	for (size_t i = 0; i < ARR_LEN(HOST_REGS) && uses[order[i]] > 0; i++) e.cache(order[i], HOST_REGS[i]);
+
+	e.prologue();
+	const size_t top = e.out.size();
+
+	// Jumps become guards on FZ that leave the trace for whichever way the recording didn't go
+	for (const TraceStep& step : trace) {
+		const Instr& in = instrs[step.index];
+
+		switch (in.op) {
+			case JMP:
+				break;
+
+			case JMP_Z:
+			case JMP_NZ: {
+				const Cond taken = in.op == JMP_Z ? CC_E : CC_NE;
+				e.testFlag();
+				if (step.taken) {
+					e.exitIf(static_cast<Cond>(taken ^ 1), code + step.index + 1);
+				} else {
+					e.exitIf(taken, code + in.target);
+				}
+				break;
+			}
+
+			default:
+				e.translate(in);
+				break;
+		}
+	}
+
+	const size_t back = e.jump(-1);
+	const int32_t rel = static_cast<int32_t>(top - (back + 4));
+	std::memcpy(&e.out[back], &rel, sizeof(rel));
+
+	NativeRegion out = install(e.out, e.accesses);
+	if (out == nullptr) return nullptr;
+
+	traceCount++;
+	native[trace[0].index] = out;
+	return out;
+}
+
+Jit::NativeRegion Jit::compile(size_t head) {
+	using namespace opcode;
+
+	const Machine& m = *machine;
+	const std::vector<Instr>& instrs = m.program.instrs;
+	const Instr* const code = m.code;
+
+	// The region is everything from head up to the first instruction the JIT doesn't handle
+	size_t end = head;
+	while (end < instrs.size() && end - head < MAX_REGION && isSupported(instrs[end].op)) end++;
+	if (end == head) return nullptr;
+
+	Emitter e(m);
+	std::vector<size_t> labels(end - head);
+	std::vector<std::pair<size_t, size_t>> fixups; // rel32 position, target index
+
+	e.prologue();
+
+	// Jumps within the region stay native, anything else leaves
+	auto jumpTo = [&](int cond, size_t target) {
+		if (target >= head && target < end) {
+			fixups.push_back(std::make_pair(e.jump(cond), target));
+		} else if (cond < 0) {
+			e.exitTo(code + target);
+		} else {
+			e.exitIf(static_cast<Cond>(cond), code + target);
+		}
+	};
+
+	for (size_t i = head; i < end; i++) {
+		const Instr& in = instrs[i];
+		labels[i - head] = e.out.size();
+
+		switch (in.op) {
+			case JMP:
+				jumpTo(-1, in.target);
+				break;
+
+			case JMP_Z:
+			case JMP_NZ:
+				e.testFlag();
+				jumpTo(in.op == JMP_Z ? CC_E : CC_NE, in.target);
+				break;
+
+			default:
+				e.translate(in);
+				break;
+		}
+	}
+
+	e.exitTo(code + end);
+
+	for (const std::pair<size_t, size_t>& fixup : fixups) {
+		int32_t rel = static_cast<int32_t>(labels[fixup.second - head] - (fixup.first + 4));
+		std::memcpy(&e.out[fixup.first], &rel, sizeof(rel));
+	}
+
+	NativeRegion out = install(e.out, e.accesses);
+	if (out == nullptr) return nullptr;
+
+	regionCount++;
+	native[head] = out;
+	return out;
+}
+
+Jit::NativeRegion Jit::install(const std::vector<uint8_t>& bytes, const std::vector<std::pair<size_t, const Instr*>>& accessesIn) {
+	if (codeUsed + bytes.size() > CODE_SIZE) return nullptr;
+	if (!writable(true)) return nullptr;
+	char* const out = codeStart + codeUsed;
+	std::memcpy(out, bytes.data(), bytes.size());
+	for (const std::pair<size_t, const Instr*>& access : accessesIn) accesses.push_back(std::make_pair(out + access.first, access.second));
+	codeUsed += (bytes.size() + 15) & ~static_cast<size_t>(15);
+	if (!writable(false)) return nullptr;
+
+	return reinterpret_cast<NativeRegion>(out);
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "executor.h"
+
+// Baseline JIT: x86-64 only, with executable memory from mmap or VirtualAlloc
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__unix__) || defined(__APPLE__) || defined(_WIN32))
+#define Z_HAS_JIT 1
+#else
+#define Z_HAS_JIT 0
+#endif
+
+namespace vm {
+	namespace executor {
+		// Compiles hot parts of the decoded program to native code
+		// The FEATURE_JIT executor instances report every taken JMP/JMP_Z/JMP_NZ to enter(). Once a target has been
+		// entered THRESHOLD times it gets compiled, one of two ways:
+		//  - Loop heads (targets of a backward JMP_Z/JMP_NZ) are traced: one trip around the loop is interpreted while
+		//    recording the path, and that path is compiled with its jumps turned into guards on FZ and its most used word
+		//    registers kept in host registers. A guard that fails leaves the trace for the way the recording didn't go.
+		//  - Anything else, or a loop whose trip can't be traced, gets a region: the straight-line instructions from the
+		//    target until the first one the JIT doesn't handle, with jumps inside the region becoming native jumps.
+		// Native code returns the instruction the interpreter should continue from, with every register written back:
+		// on leaving, on anything it doesn't handle (R_JMP, syscalls, ...), and just before anything that would throw, so
+		// the interpreter raises the same ExecutorException from the same location.
+		class Jit {
+		public:
+			static constexpr uint32_t THRESHOLD = 64;
+			static constexpr int MAX_REGION = 1024;				// Instructions per compiled region
+			static constexpr size_t MAX_TRACE = 256;				// Instructions per trip around a traced loop
+			static constexpr size_t CODE_SIZE = 4 * 1024 * 1024;	// Bytes of native code, after which compiling stops
+
+			Jit();
+			~Jit();
+
+			// False if there's no JIT for this platform or no executable memory
+			bool start(Machine& m);
+
+			// Called with each taken jump and its target; runs native code from there if there is (or should be) some
+			// Returns the instruction to continue interpreting from
+			const Instr* enter(const Instr* from, const Instr* ip);
+
+			// The memory opcode whose native code pc is in, for reporting a stack overflow caught there, or nullptr
+			const Instr* accessAt(const void* pc) const;
+
+			int regions() const;
+			int traces() const;
+
+		private:
+			typedef const Instr* (*NativeRegion)();
+
+			struct TraceStep {
+				size_t index;		// Into Program::instrs
+				bool taken;			// Whether a jump went to its target
+			};
+
+			Machine* machine;
+			std::vector<uint32_t> heat;				// Entries per instruction, indexed like Program::instrs
+			std::vector<NativeRegion> native;		// Compiled trace or region starting at each instruction, or nullptr
+			char* codeStart;
+			size_t codeUsed;
+			int regionCount;
+			int traceCount;
+			std::vector<std::pair<const char*, const Instr*>> accesses;	// Start of each memory access in the code, in order
+
+			const Instr* record(size_t head, std::vector<TraceStep>& trace);
+			NativeRegion compileTrace(const std::vector<TraceStep>& trace);
+			NativeRegion compile(size_t head);
+			NativeRegion install(const std::vector<uint8_t>& bytes, const std::vector<std::pair<size_t, const Instr*>>& accessesIn);
+			bool writable(bool on);
+		};
+	}
+}
\ No newline at end of file
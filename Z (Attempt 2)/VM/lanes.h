@@ -0,0 +1,280 @@
+#pragma once
+
+#include "vm.h"
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// SSE2 is part of every x86-64 host; SSE4.1 adds the 32-bit integer multiply, min and max
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define Z_HAS_SSE2 1
+#else
+#define Z_HAS_SSE2 0
+#endif
+
+#if Z_HAS_SSE2 && (defined(__SSE4_1__) || defined(__AVX__))
+#include <smmintrin.h>
+#define Z_HAS_SSE41 1
+#else
+#define Z_HAS_SSE41 0
+#endif
+
+namespace vm {
+	namespace executor {
+		// Lane-wise operations on vector registers, for the vector opcodes, and byte scans for the string opcodes
+		// Each uses SSE where the build targets it, and a loop over the lanes otherwise, with the same results either way:
+		// integers wrap, float min and max return the second operand when either is NaN (like minps and maxps), and
+		// sums add the lanes pairwise in the same order.
+		namespace lanes {
+			using types::VecVal;
+			constexpr int N = register_::VECTOR_LANES;
+
+			static_assert(sizeof(VecVal) == 16, "Vector registers are laid out as one SSE register");
+
+			inline void load(VecVal& out, const char* from) {
+				std::memcpy(&out, from, sizeof(out));
+			}
+
+			inline void store(char* to, const VecVal& v) {
+				std::memcpy(to, &v, sizeof(v));
+			}
+
+			inline void splat(VecVal& out, types::WordVal word) {
+				for (int i = 0; i < N; i++) out.lane[i] = word;
+			}
+
+#if Z_HAS_SSE2
+			inline __m128i getI(const VecVal& v) {
+				return _mm_load_si128(reinterpret_cast<const __m128i*>(&v));
+			}
+
+			inline void setI(VecVal& out, __m128i v) {
+				_mm_store_si128(reinterpret_cast<__m128i*>(&out), v);
+			}
+
+			inline __m128 getF(const VecVal& v) {
+				return _mm_load_ps(reinterpret_cast<const float*>(&v));
+			}
+
+			inline void setF(VecVal& out, __m128 v) {
+				_mm_store_ps(reinterpret_cast<float*>(&out), v);
+			}
+#endif
+
+			// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+			// Integers
+
+			inline void addI(VecVal& out, const VecVal& a, const VecVal& b) {
+#if Z_HAS_SSE2
+				setI(out, _mm_add_epi32(getI(a), getI(b)));
+#else
+				for (int i = 0; i < N; i++) out.lane[i].word = static_cast<types::word_t>(static_cast<uint32_t>(a.lane[i].word) + static_cast<uint32_t>(b.lane[i].word));
+#endif
+			}
+
+			inline void subI(VecVal& out, const VecVal& a, const VecVal& b) {
+#if Z_HAS_SSE2
+				setI(out, _mm_sub_epi32(getI(a), getI(b)));
+#else
+				for (int i = 0; i < N; i++) out.lane[i].word = static_cast<types::word_t>(static_cast<uint32_t>(a.lane[i].word) - static_cast<uint32_t>(b.lane[i].word));
+#endif
+			}
+
+			inline void mulI(VecVal& out, const VecVal& a, const VecVal& b) {
+#if Z_HAS_SSE41
+				setI(out, _mm_mullo_epi32(getI(a), getI(b)));
+#else
+				for (int i = 0; i < N; i++) out.lane[i].word = static_cast<types::word_t>(static_cast<uint32_t>(a.lane[i].word) * static_cast<uint32_t>(b.lane[i].word));
+#endif
+			}
+
+			// No SIMD integer division anywhere; the caller checks for zero lanes
+			inline void divI(VecVal& out, const VecVal& a, const VecVal& b) {
+				for (int i = 0; i < N; i++) out.lane[i].int_ = a.lane[i].int_ / b.lane[i].int_;
+			}
+
+			inline void minI(VecVal& out, const VecVal& a, const VecVal& b) {
+#if Z_HAS_SSE41
+				setI(out, _mm_min_epi32(getI(a), getI(b)));
+#else
+				for (int i = 0; i < N; i++) out.lane[i].int_ = a.lane[i].int_ < b.lane[i].int_ ? a.lane[i].int_ : b.lane[i].int_;
+#endif
+			}
+
+			inline void maxI(VecVal& out, const VecVal& a, const VecVal& b) {
+#if Z_HAS_SSE41
+				setI(out, _mm_max_epi32(getI(a), getI(b)));
+#else
+				for (int i = 0; i < N; i++) out.lane[i].int_ = a.lane[i].int_ > b.lane[i].int_ ? a.lane[i].int_ : b.lane[i].int_;
+#endif
+			}
+
+			// (0 + 2) + (1 + 3)
+			inline types::int_t sumI(const VecVal& v) {
+#if Z_HAS_SSE2
+				__m128i t = _mm_add_epi32(getI(v), _mm_shuffle_epi32(getI(v), _MM_SHUFFLE(1, 0, 3, 2)));
+				t = _mm_add_epi32(t, _mm_shuffle_epi32(t, _MM_SHUFFLE(2, 3, 0, 1)));
+				return _mm_cvtsi128_si32(t);
+#else
+				const uint32_t low = static_cast<uint32_t>(v.lane[0].word) + static_cast<uint32_t>(v.lane[2].word);
+				const uint32_t high = static_cast<uint32_t>(v.lane[1].word) + static_cast<uint32_t>(v.lane[3].word);
+				return static_cast<types::int_t>(low + high);
+#endif
+			}
+
+			// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+			// Floats
+
+			inline void addF(VecVal& out, const VecVal& a, const VecVal& b) {
+#if Z_HAS_SSE2
+				setF(out, _mm_add_ps(getF(a), getF(b)));
+#else
+				for (int i = 0; i < N; i++) out.lane[i].float_ = a.lane[i].float_ + b.lane[i].float_;
+#endif
+			}
+
+			inline void subF(VecVal& out, const VecVal& a, const VecVal& b) {
+#if Z_HAS_SSE2
+				setF(out, _mm_sub_ps(getF(a), getF(b)));
+#else
+				for (int i = 0; i < N; i++) out.lane[i].float_ = a.lane[i].float_ - b.lane[i].float_;
+#endif
+			}
+
+			inline void mulF(VecVal& out, const VecVal& a, const VecVal& b) {
+#if Z_HAS_SSE2
+				setF(out, _mm_mul_ps(getF(a), getF(b)));
+#else
+				for (int i = 0; i < N; i++) out.lane[i].float_ = a.lane[i].float_ * b.lane[i].float_;
+#endif
+			}
+
+			// The caller checks for zero lanes
+			inline void divF(VecVal& out, const VecVal& a, const VecVal& b) {
+#if Z_HAS_SSE2
+				setF(out, _mm_div_ps(getF(a), getF(b)));
+#else
+				for (int i = 0; i < N; i++) out.lane[i].float_ = a.lane[i].float_ / b.lane[i].float_;
+#endif
+			}
+
+			inline void minF(VecVal& out, const VecVal& a, const VecVal& b) {
+#if Z_HAS_SSE2
+				setF(out, _mm_min_ps(getF(a), getF(b)));
+#else
+				for (int i = 0; i < N; i++) out.lane[i].float_ = a.lane[i].float_ < b.lane[i].float_ ? a.lane[i].float_ : b.lane[i].float_;
+#endif
+			}
+
+			inline void maxF(VecVal& out, const VecVal& a, const VecVal& b) {
+#if Z_HAS_SSE2
+				setF(out, _mm_max_ps(getF(a), getF(b)));
+#else
+				for (int i = 0; i < N; i++) out.lane[i].float_ = a.lane[i].float_ > b.lane[i].float_ ? a.lane[i].float_ : b.lane[i].float_;
+#endif
+			}
+
+			// (0 + 2) + (1 + 3)
+			inline types::float_t sumF(const VecVal& v) {
+#if Z_HAS_SSE2
+				const __m128 t = _mm_add_ps(getF(v), _mm_movehl_ps(getF(v), getF(v)));
+				return _mm_cvtss_f32(_mm_add_ss(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 1, 1, 1))));
+#else
+				return (v.lane[0].float_ + v.lane[2].float_) + (v.lane[1].float_ + v.lane[3].float_);
+#endif
+			}
+
+			// Whether any lane is zero, as an integer or a float, for the divisions
+			inline bool anyZeroI(const VecVal& v) {
+				for (int i = 0; i < N; i++) {
+					if (v.lane[i].int_ == 0) return true;
+				}
+				return false;
+			}
+
+			inline bool anyZeroF(const VecVal& v) {
+				for (int i = 0; i < N; i++) {
+					if (v.lane[i].float_ == 0) return true;
+				}
+				return false;
+			}
+
+			// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+			// Strings
+			// Null-terminated strings, scanned 16 bytes at a time. Loads never cross into a page the string doesn't reach,
+			// so a scan only faults where a byte at a time loop would: aligned loads can't, and unaligned ones are only
+			// used while both fit in the page.
+
+			constexpr uintptr_t PAGE = 4096;	// The smallest page any host has
+
+#if Z_HAS_SSE2
+			// Index of the lowest set bit, which mustn't be 0
+			inline int lowestBit(unsigned int mask) {
+#ifdef _MSC_VER
+				unsigned long index;
+				_BitScanForward(&index, mask);
+				return static_cast<int>(index);
+#else
+				return __builtin_ctz(mask);
+#endif
+			}
+
+			// A bit for each of the 16 bytes at block (aligned) that is 0 or c
+			inline unsigned int scanFor(const char* block, __m128i c) {
+				const __m128i bytes = _mm_load_si128(reinterpret_cast<const __m128i*>(block));
+				return static_cast<unsigned int>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_setzero_si128()), _mm_cmpeq_epi8(bytes, c))));
+			}
+#endif
+
+			// The string's terminator, or the first byte equal to c if that comes first
+			inline const char* find(const char* s, char c) {
+#if Z_HAS_SSE2
+				const __m128i cs = _mm_set1_epi8(c);
+				const unsigned int misalign = static_cast<unsigned int>(reinterpret_cast<uintptr_t>(s) & 15);
+				const char* block = s - misalign;
+				unsigned int mask = scanFor(block, cs) & (0xffffu << misalign);
+				while (mask == 0) {
+					block += 16;
+					mask = scanFor(block, cs);
+				}
+				return block + lowestBit(mask);
+#else
+				while (*s != c && *s != '\0') s++;
+				return s;
+#endif
+			}
+
+			inline size_t length(const char* s) {
+				return static_cast<size_t>(find(s, '\0') - s);
+			}
+
+			// Like std::strcmp, comparing as unsigned bytes
+			inline int compare(const char* a, const char* b) {
+#if Z_HAS_SSE2
+				while (true) {
+					if ((reinterpret_cast<uintptr_t>(a) & (PAGE - 1)) <= PAGE - 16 && (reinterpret_cast<uintptr_t>(b) & (PAGE - 1)) <= PAGE - 16) {
+						const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+						const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+						const unsigned int differ = ~static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y))) & 0xffffu;
+						const unsigned int mask = differ | static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128())));
+						if (mask != 0) {
+							const int i = lowestBit(mask);
+							return static_cast<unsigned char>(a[i]) - static_cast<unsigned char>(b[i]);
+						}
+						a += 16;
+						b += 16;
+					} else {
+						if (*a != *b || *a == '\0') return static_cast<unsigned char>(*a) - static_cast<unsigned char>(*b);
+						a++;
+						b++;
+					}
+				}
+#else
+				return std::strcmp(a, b);
+#endif
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include "mapping.h"
+
+#include <algorithm>
+
+#if Z_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using vm::MappedFile;
+
+MappedFile::MappedFile() : start(nullptr), length(0), mapped(0) {}
+
+MappedFile::~MappedFile() {
+#if Z_HAS_MMAP
+	if (start != nullptr && mapped > 0) munmap(start, mapped);
+#endif
+}
+
+bool MappedFile::map(const char* path, size_t filler, vm::executor::Memory* into) {
+#if Z_HAS_MMAP
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+		close(fd);
+		return false;
+	}
+
+	const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const size_t size = static_cast<size_t>(info.st_size);
+	const size_t filePages = (size + page - 1) / page * page;
+	const size_t total = (size + filler + page - 1) / page * page;
+
+	// Reserve room for the file and the guard page together, then map the file over the start of it
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	char* at = nullptr;
+	if (into != nullptr && into->base != nullptr) {
+		at = into->base + into->claim(total, true);
+		flags |= MAP_FIXED;
+	}
+
+	void* reserved = mmap(at, total, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (reserved == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+
+	void* file = mmap(reserved, filePages, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+	close(fd);
+	if (file == MAP_FAILED) {
+		// Inside a Memory the region stays claimed, and harmlessly accessible
+		if (at == nullptr) munmap(reserved, total);
+		return false;
+	}
+
+	start = static_cast<char*>(reserved);
+	length = size;
+	mapped = at == nullptr ? total : 0;
+
+	// Only copies the file's last page, if the filler starts inside it
+	std::fill(start + length, start + length + filler, charFiller);
+	return true;
+#else
+	return false;
+#endif
+}
\ No newline at end of file
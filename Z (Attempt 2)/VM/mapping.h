@@ -0,0 +1,33 @@
+#pragma once
+
+#include "memory.h"
+
+// Programs are mapped with mmap; elsewhere they're read into memory as before
+#if defined(__unix__) || defined(__APPLE__)
+#define Z_HAS_MMAP 1
+#else
+#define Z_HAS_MMAP 0
+#endif
+
+namespace vm {
+	// A bytecode file mapped into memory, followed by some bytes of charFiller
+	// The mapping is private: pages are shared with the page cache (and with every other run of the same file) until
+	// the program writes to them, and only the pages touched are ever read. Globals live alongside the code, so it has
+	// to stay writable. The filler goes in the tail of the file's last page when there's room, and otherwise in an
+	// anonymous guard page mapped right after it, so nothing is copied up front.
+	// Mapped into a Memory, it's placed in a region claimed from it, and the Memory unmaps it along with everything else.
+	class MappedFile {
+	public:
+		char* start;
+		size_t length;	// Of the file, not including the filler
+
+		MappedFile();
+		~MappedFile();
+
+		// False if the platform can't map files or the file can't be mapped, in which case it should be read instead
+		bool map(const char* path, size_t filler, executor::Memory* into = nullptr);
+
+	private:
+		size_t mapped;	// 0 if into a Memory
+	};
+}
\ No newline at end of file
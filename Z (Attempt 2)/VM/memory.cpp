@@ -0,0 +1,406 @@
+#include "memory.h"
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <new>
+
+#if Z_SANDBOX
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__) && defined(__x86_64__)
+#include <ucontext.h>
+#endif
+#endif
+#endif
+
+using vm::executor::Memory;
+using vm::executor::StackTrap;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Faults
+//
+// A fault inside any live reservation is either the stack growing, which is let through, an access out of bounds (past
+// the stack limit or anywhere else) that a StackTrap is armed for, or one it can't be caught for, reported and ended
+// here since there is no way back to the handler that made it. Faults anywhere else go to whatever handled them before.
+
+#if Z_STACK_TRAP
+namespace {
+	constexpr int MAX_RESERVATIONS = 256;
+	constexpr uint64_t RESERVED = Memory::SPAN + Memory::GRANULE;
+
+	std::atomic<Memory*> reservations[MAX_RESERVATIONS];
+	struct sigaction previousSegv;
+	struct sigaction previousBus;
+	thread_local StackTrap* armed = nullptr;
+
+	void writeAll(const char* str, size_t length) {
+		while (length > 0) {
+			const ssize_t written = write(STDOUT_FILENO, str, length);
+			if (written <= 0) return;
+			str += written;
+			length -= written;
+		}
+	}
+
+	const void* faultPc(void* context) {
+#if defined(__linux__) && defined(__x86_64__)
+		return reinterpret_cast<const void*>(static_cast<ucontext_t*>(context)->uc_mcontext.gregs[REG_RIP]);
+#else
+		return nullptr;
+#endif
+	}
+
+	// Of the guards after green threads' stacks, see Memory::carveStack
+	uint64_t pageSize() {
+		static const uint64_t size = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+		return size;
+	}
+}
+
+namespace vm {
+	namespace executor {
+		struct MemoryFaults {
+			// Past the stack's limit into its guard, or past a green thread's slice into the guard at its end: everything
+			// else in the slices is accessible
+			static bool overflows(const Memory* memory, uint64_t offset) {
+				if (offset >= memory->growTo && offset < memory->growTo + Memory::GRANULE) return true;
+				return offset >= memory->slicesFrom && offset < memory->slicesTo;
+			}
+
+			static void onFault(int sig, siginfo_t* info, void* context) {
+				const char* addr = static_cast<const char*>(info->si_addr);
+
+				for (std::atomic<Memory*>& slot : reservations) {
+					Memory* memory = slot.load(std::memory_order_acquire);
+					if (memory == nullptr || addr < memory->base || addr >= memory->base + RESERVED) continue;
+					const uint64_t offset = static_cast<uint64_t>(addr - memory->base);
+
+					if (offset >= memory->growFrom && offset < memory->growTo) {
+						const uint64_t from = offset / Memory::GRANULE * Memory::GRANULE;
+						// Stopping at growTo, which is only a page short of a green thread's slice once one is carved
+						const uint64_t size = memory->growTo - from < Memory::GRANULE ? memory->growTo - from : Memory::GRANULE;
+						// Returning runs the access again, now that it can succeed
+						if (mprotect(memory->base + from, static_cast<size_t>(size), PROT_READ | PROT_WRITE) == 0) {
+							if (from + size > memory->grown) memory->grown = from + size;
+							return;
+						}
+					}
+
+					StackTrap* const trap = armed;
+					if (trap != nullptr) {
+						const void* const pc = faultPc(context);
+						const char* const at = static_cast<const char*>(pc);
+						if (trap->access != nullptr || (at != nullptr && at >= trap->nativeStart && at < trap->nativeEnd)) {
+							trap->address = offset;
+							trap->overflow = overflows(memory, offset);
+							trap->pc = pc;
+							siglongjmp(trap->jump, 1);
+						}
+					}
+
+					// No iostreams or snprintf in a signal handler
+					char digits[24];
+					int n = sizeof(digits);
+					uint64_t value = offset;
+					do {
+						digits[--n] = static_cast<char>('0' + value % 10);
+						value /= 10;
+					} while (value > 0);
+
+					static const char before[] = IO_ERR "Error during execution : Memory access out of bounds at address ";
+					static const char after[] = IO_NORM IO_END;
+					writeAll(before, sizeof(before) - 1);
+					writeAll(digits + n, sizeof(digits) - n);
+					writeAll(after, sizeof(after) - 1);
+					_exit(1);
+				}
+
+				// Returning runs the faulting instruction again, under the old handler
+				sigaction(sig, sig == SIGSEGV ? &previousSegv : &previousBus, nullptr);
+			}
+
+			static void watch(Memory* memory) {
+				static std::once_flag installed;
+				std::call_once(installed, [] {
+					struct sigaction action = {};
+					action.sa_sigaction = onFault;
+					action.sa_flags = SA_SIGINFO;
+					sigemptyset(&action.sa_mask);
+					sigaction(SIGSEGV, &action, &previousSegv);
+					sigaction(SIGBUS, &action, &previousBus);
+				});
+
+				// A full table just means that sandbox's faults go unreported, and its stack never grows
+				for (std::atomic<Memory*>& slot : reservations) {
+					Memory* empty = nullptr;
+					if (slot.compare_exchange_strong(empty, memory)) return;
+				}
+			}
+
+			static void unwatch(Memory* memory) {
+				for (std::atomic<Memory*>& slot : reservations) {
+					Memory* expected = memory;
+					if (slot.compare_exchange_strong(expected, nullptr)) return;
+				}
+			}
+		};
+	}
+}
+#endif
+
+void StackTrap::arm() {
+#if Z_STACK_TRAP
+	armed = this;
+#endif
+}
+
+void StackTrap::disarm() {
+#if Z_STACK_TRAP
+	if (armed == this) armed = nullptr;
+#endif
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+Memory::Memory() : base(nullptr), top(0), stack(0), growFrom(0), growTo(0), grown(0), stackEnd(0), slicesFrom(0), slicesTo(0) {}
+
+Memory::~Memory() {
+#if Z_SANDBOX
+	if (base == nullptr) return;
+#ifdef _WIN32
+	VirtualFree(base, 0, MEM_RELEASE);
+#else
+	vm::executor::MemoryFaults::unwatch(this);
+	munmap(base, SPAN + GRANULE);
+#endif
+#else
+	release(0);
+#endif
+}
+
+void Memory::reserve() {
+#if Z_SANDBOX
+	void* reserved;
+#ifdef _WIN32
+	reserved = VirtualAlloc(nullptr, SPAN + GRANULE, MEM_RESERVE, PAGE_NOACCESS);
+	if (reserved == nullptr) throw std::bad_alloc();
+#else
+	reserved = mmap(nullptr, SPAN + GRANULE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (reserved == MAP_FAILED) throw std::bad_alloc();
+#endif
+	base = static_cast<char*>(reserved);
+#if Z_STACK_TRAP
+	vm::executor::MemoryFaults::watch(this);
+#endif
+	top = PROGRAM;
+#endif
+}
+
+uint32_t Memory::allocate(size_t size, bool guarded) {
+#if Z_SANDBOX
+	const uint32_t offset = claim(size, guarded);
+	commit(offset, size);
+	return offset;
+#else
+	char* block = new char[size];
+	blocks.push_back(block);
+	return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(block));
+#endif
+}
+
+uint32_t Memory::claim(size_t size, bool guarded) {
+	const uint64_t offset = top;
+	const uint64_t end = (offset + size + GRANULE - 1) / GRANULE * GRANULE + (guarded ? GRANULE : 0);
+	if (base == nullptr || end > SPAN) throw std::bad_alloc();
+
+	top = end;
+	claimed.push_back({ static_cast<uint32_t>(offset), static_cast<uint32_t>(size) });
+	return static_cast<uint32_t>(offset);
+}
+
+uint32_t Memory::allocateStack(size_t size, size_t limit) {
+	if (stack != 0) return stack;
+#if Z_STACK_TRAP
+	stack = claim(limit, true);
+	commit(stack, size);
+	growFrom = stack + size;
+	growTo = stack + limit;
+	grown = growFrom;
+	stackEnd = growTo;
+	return stack;
+#else
+	stack = allocate(limit, true);
+	stackEnd = stack + static_cast<uint64_t>(limit);
+	return stack;
+#endif
+}
+
+void Memory::commitStack() {
+	if (grown > growFrom) commit(static_cast<uint32_t>(growFrom), static_cast<size_t>(grown - growFrom));
+	growFrom = grown;
+}
+
+uint32_t Memory::carveStack(size_t size) {
+	if (stack == 0 || size == 0) return 0;
+#if Z_STACK_TRAP
+	const uint64_t guard = pageSize();
+	const uint64_t stride = (size + guard - 1) / guard * guard + guard;
+	const uint64_t from = slicesFrom != 0 ? slicesFrom : stackEnd / guard * guard;
+#else
+	const uint64_t stride = size;
+	const uint64_t from = slicesFrom != 0 ? slicesFrom : stackEnd;
+#endif
+	if (from < stack + 2 * stride) return 0;
+
+	const uint64_t offset = from - stride;
+#if Z_STACK_TRAP
+	// Everything from the stack's new guard up is still inaccessible, so the slice's guard (the page below the last
+	// slice, which was the stack's guard until now) needs nothing done
+	if (offset - guard < grown) return 0;
+	commit(static_cast<uint32_t>(offset), static_cast<size_t>(stride - guard));
+	growTo = offset - guard;
+	if (slicesTo == 0) slicesTo = from;
+#endif
+	slicesFrom = offset;
+	return static_cast<uint32_t>(offset);
+}
+
+size_t Memory::mark() const {
+#if Z_SANDBOX
+	return static_cast<size_t>(top);
+#else
+	return blocks.size();
+#endif
+}
+
+// Hands the pages back to the host, but keeps them reserved
+void Memory::release(size_t to) {
+#if Z_SANDBOX
+	if (base == nullptr || to >= top) return;
+	const size_t length = static_cast<size_t>(top - to);
+#ifdef _WIN32
+	VirtualFree(base + to, length, MEM_DECOMMIT);
+#else
+	mmap(base + to, length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+#endif
+	top = to;
+	while (!claimed.empty() && claimed.back().offset >= to) claimed.pop_back();
+	if (stack >= to) stack = 0;
+	if (growTo > top) growFrom = growTo = grown = stackEnd = slicesFrom = slicesTo = 0;
+#else
+	while (blocks.size() > to) {
+		if (reinterpret_cast<uintptr_t>(blocks.back()) == stack) {
+			stack = 0;
+			stackEnd = slicesFrom = 0;
+		}
+		delete[] blocks.back();
+		blocks.pop_back();
+	}
+#endif
+}
+
+const std::vector<Memory::Region>& Memory::regions() const {
+	return claimed;
+}
+
+uint32_t Memory::stackOffset() const {
+	return stack;
+}
+
+uint64_t Memory::stackUsed() const {
+	return grown;
+}
+
+bool Memory::restore(const char* path, uint64_t to, const std::vector<Region>& regionsIn, uint32_t stackIn, uint64_t used) {
+#if Z_SANDBOX
+	if (base == nullptr || to < PROGRAM || to > SPAN) return false;
+
+	// Regions in order, each on a GRANULE and clear of the one before
+	uint64_t end = PROGRAM;
+	bool hasStack = stackIn == 0;
+	for (const Region& region : regionsIn) {
+		if (region.offset < end || region.offset % GRANULE != 0 || region.offset + static_cast<uint64_t>(region.size) > to) return false;
+		end = region.offset + static_cast<uint64_t>(region.size);
+		hasStack = hasStack || region.offset == stackIn;
+	}
+	if (!hasStack) return false;
+
+#ifdef _WIN32
+	std::fstream file;
+	file.open(path, std::ios::in | std::ios::binary);
+	if (!file.is_open()) return false;
+	file.seekg(0, std::ios::end);
+	if (static_cast<uint64_t>(file.tellg()) < to) return false;
+
+	for (const Region& region : regionsIn) {
+		if (region.size == 0) continue;
+		if (VirtualAlloc(base + region.offset, region.size, MEM_COMMIT, PAGE_READWRITE) == nullptr) return false;
+		file.seekg(region.offset);
+		file.read(base + region.offset, region.size);
+		if (!file) return false;
+	}
+#else
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || static_cast<uint64_t>(info.st_size) < to) {
+		close(fd);
+		return false;
+	}
+
+	// Private, so pages are only copied once written, and the file never is
+	void* mapped = mmap(base + PROGRAM, static_cast<size_t>(to - PROGRAM), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, PROGRAM);
+	close(fd);
+	if (mapped == MAP_FAILED) {
+		mmap(base + PROGRAM, static_cast<size_t>(to - PROGRAM), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+		return false;
+	}
+
+	// Guards and whatever lay between regions go back to being inaccessible
+	uint64_t from = PROGRAM;
+	for (const Region& region : regionsIn) {
+		if (region.offset > from) mprotect(base + from, static_cast<size_t>(region.offset - from), PROT_NONE);
+		from = (region.offset + static_cast<uint64_t>(region.size) + GRANULE - 1) / GRANULE * GRANULE;
+	}
+	if (to > from) mprotect(base + from, static_cast<size_t>(to - from), PROT_NONE);
+#endif
+
+	top = to;
+	claimed = regionsIn;
+	stack = stackIn;
+	growFrom = growTo = grown = stackEnd = slicesFrom = slicesTo = 0;
+	// All of the stack came back accessible, but overflowing it still hits the guard
+	for (const Region& region : claimed) {
+		if (stack != 0 && region.offset == stack) growFrom = growTo = grown = stackEnd = region.offset + static_cast<uint64_t>(region.size);
+	}
+#if Z_STACK_TRAP
+	// What the program hadn't reached goes back to growing on demand, so carveStack knows it's unused
+	const uint64_t reached = (used + GRANULE - 1) / GRANULE * GRANULE;
+	if (stack != 0 && used >= stack && reached < stackEnd) {
+		mprotect(base + reached, static_cast<size_t>(stackEnd - reached), PROT_NONE);
+		growFrom = grown = reached;
+	}
+#endif
+	return true;
+#else
+	return false;
+#endif
+}
+
+void Memory::commit(uint32_t offset, size_t size) {
+#if Z_SANDBOX
+	if (size == 0) return;
+#ifdef _WIN32
+	if (VirtualAlloc(base + offset, size, MEM_COMMIT, PAGE_READWRITE) == nullptr) throw std::bad_alloc();
+#else
+	if (mprotect(base + offset, size, PROT_READ | PROT_WRITE) != 0) throw std::bad_alloc();
+#endif
+#endif
+}
\ No newline at end of file
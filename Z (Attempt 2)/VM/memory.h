@@ -0,0 +1,134 @@
+#pragma once
+
+#include "vm.h"
+#include <vector>
+
+// 64-bit hosts give every VM a sandbox of its own; on 32-bit hosts a word can hold a host address, and does
+#if UINTPTR_MAX > 0xffffffffu
+#define Z_SANDBOX 1
+#else
+#define Z_SANDBOX 0
+#endif
+
+// Stacks that grow on demand and overflows caught as they happen need the sandbox's fault handler, which is POSIX only
+#if Z_SANDBOX && !defined(_WIN32)
+#define Z_STACK_TRAP 1
+#include <setjmp.h>
+#else
+#define Z_STACK_TRAP 0
+#endif
+
+namespace vm {
+	namespace executor {
+		// The linear memory a program runs in: its bytecode, its stack and its heap
+		// Word values used as addresses (PP, BP, RP, anything from ALLOC) are offsets from base, so registers stay 32 bits
+		// on any host. With Z_SANDBOX, base is a reservation covering every offset a word can hold plus a guard, and only
+		// the regions handed out are ever made accessible, so any access outside them faults instead of touching host
+		// memory: bounds checks cost nothing. The fault is thrown from the instruction that made it where a StackTrap can
+		// catch it, and otherwise ends the process with an error naming the offset.
+		// Without Z_SANDBOX, base is nullptr and regions come straight from the host allocator, as before.
+		class Memory {
+		public:
+			static constexpr uint64_t SPAN = 1ull << 32;		// Every offset a word can hold
+			static constexpr size_t GRANULE = 0x10000;			// Regions start and end on this, which is also the guard size
+			static constexpr uint32_t PROGRAM = GRANULE;		// Where the bytecode goes, with offsets below it never accessible
+
+			struct Region {
+				uint32_t offset;
+				uint32_t size;		// As asked for, guard not included
+			};
+
+			char* base;
+
+			Memory();
+			~Memory();
+
+			// Sets up the address space; throws std::bad_alloc if the host won't reserve it
+			// Memory that's never reserved, like a worker's view of a Program, owns nothing
+			void reserve();
+
+			// Returns the offset of size accessible bytes, starting on a GRANULE boundary
+			// Guarded regions have an inaccessible GRANULE after them. Throws std::bad_alloc once the span is used up
+			// Not thread-safe: once a program runs, only the Heap calls it, under its own lock
+			uint32_t allocate(size_t size, bool guarded);
+			// Like allocate, but left inaccessible for the caller to map something over, see MappedFile
+			uint32_t claim(size_t size, bool guarded);
+			// Like allocate with a guard, but only size bytes are accessible up front: with Z_STACK_TRAP, the rest up to
+			// limit is made accessible a GRANULE at a time as it's first touched. One per Memory, so a restored Memory
+			// returns the stack it came with
+			uint32_t allocateStack(size_t size, size_t limit);
+			// Makes all of the stack reached so far accessible now, for reading it whole: with Z_STACK_TRAP, what it grew
+			// into on demand may have gaps
+			void commitStack();
+			// Returns the offset of size bytes at the top of the stack's limit, below any carved before, for a green
+			// thread's own stack. With Z_STACK_TRAP, size is rounded up to whole pages and every slice ends in a guard
+			// page, as does the stack left below them, which stops growing short of it. Returns 0 once that would leave
+			// the stack below with less than a slice, or (with Z_STACK_TRAP) the slice would take any of the stack that
+			// has already been made accessible, which the main thread may be using
+			uint32_t carveStack(size_t size);
+
+			// Everything allocated after mark() is given back by release(), in reverse order of marking
+			size_t mark() const;
+			void release(size_t to);
+
+			// Z_SANDBOX only: every region handed out, in order, with a stack counted up to its limit
+			const std::vector<Region>& regions() const;
+			uint32_t stackOffset() const;		// Or 0 without a stack
+			uint64_t stackUsed() const;			// Z_STACK_TRAP: end of the stack made accessible so far, see carveStack
+			// Replaces everything handed out with the image of another Memory in the file at path, which holds each region
+			// at its own offset, up to to. Mapped copy-on-write where the platform allows, otherwise read in
+			// The stack past used is made inaccessible again, to grow into as before
+			// Returns false, having changed nothing, if the file or the regions don't fit. See Snapshot
+			bool restore(const char* path, uint64_t to, const std::vector<Region>& regionsIn, uint32_t stackIn, uint64_t used);
+
+		private:
+			uint64_t top;				// Z_SANDBOX: end of the last region claimed, guard included
+			std::vector<char*> blocks;	// Otherwise: every region allocated, in order
+			std::vector<Region> claimed;
+			uint32_t stack;
+			uint64_t growFrom;			// Z_STACK_TRAP: the stack's offsets made accessible on demand, then its guard
+			uint64_t growTo;
+			uint64_t grown;				// Z_STACK_TRAP: end of the stack made accessible, up front or on demand
+			uint64_t stackEnd;			// Of the stack's limit
+			uint64_t slicesFrom;		// The slices carveStack has handed out, or 0 before the first
+			uint64_t slicesTo;
+
+			void commit(uint32_t offset, size_t size);
+
+			friend struct MemoryFaults;
+		};
+
+		// Turns a stack overflow or other access out of bounds on the thread that armed it into a jump back to where it was
+		// armed, see run_
+		// Only faults with access set or inside the JIT's code are caught, since the jump skips every frame in between:
+		// anything else faulting (a string opcode holding the IO lock, say) is reported and ends the process. See
+		// markAccess.
+		class StackTrap {
+		public:
+			const void* volatile access;	// The instruction accessing memory, or nullptr if it can't be left early
+			const char* nativeStart;		// Code the JIT's accesses come from
+			const char* nativeEnd;
+			uint64_t address;				// Of the faulting access, once caught
+			bool overflow;					// Whether that was past the stack limit, rather than anywhere else
+			const void* pc;					// Host instruction that made it, or nullptr where the platform doesn't say
+#if Z_STACK_TRAP
+			sigjmp_buf jump;
+#endif
+
+			StackTrap() : access(nullptr), nativeStart(nullptr), nativeEnd(nullptr), address(0), overflow(false), pc(nullptr) {}
+
+			// Armed around the frame that sets jump, and disarmed before it returns
+			void arm();
+			void disarm();
+		};
+
+		// Host address of the word address offset bytes after address, wrapping within the span like the sandbox does
+		inline char* hostAddress(char* base, types::word_t address, types::word_t offset = 0) {
+			return reinterpret_cast<char*>(reinterpret_cast<uintptr_t>(base) + (static_cast<uint32_t>(address) + static_cast<uint32_t>(offset)));
+		}
+
+		inline types::word_t wordAddress(const char* base, const void* host) {
+			return static_cast<types::word_t>(static_cast<uint32_t>(reinterpret_cast<uintptr_t>(host) - reinterpret_cast<uintptr_t>(base)));
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,244 @@
+#include "profiler.h"
+#include "executorops.h"
+#include <algorithm>
+
+using vm::executor::Profiler;
+
+namespace {
+	using namespace vm::executor;
+
+	constexpr int CANDIDATE_COUNT = 8;
+
+	struct Sequence {
+		int ops[3];
+		int length;
+		uint64_t count;
+	};
+
+	// Enum names for printing EXEC_FUSIONS entries, which name opcodes the way the source does
+	const char* enumName(int op) {
+		using namespace opcode;
+		using namespace execop;
+
+		static const char* names[execop::COUNT] = {};
+		if (names[NOP] == nullptr) {
+#define NAME_OP(op) names[op] = #op;
+			EXEC_OPCODES(NAME_OP)
+#undef NAME_OP
+			names[HALT] = "HALT";
+		}
+		return names[op] != nullptr ? names[op] : "?";
+	}
+
+	// Whether op always continues to the next instruction, which the ops before the last in a superinstruction must
+	bool fallsThrough(int op) {
+		using namespace opcode;
+
+		if (op >= opcode::count) return false;
+		switch (op) {
+			case HALT:
+			case JMP:
+			case JMP_Z:
+			case JMP_NZ:
+			case R_JMP:
+			case R_JMP_Z:
+			case R_JMP_NZ:
+			case CALL:
+			case RET:
+			case JOIN:
+			case YIELD:
+				return false;
+
+			default:
+				return true;
+		}
+	}
+
+	std::vector<Sequence> sortedSequences(const Profiler& profiler) {
+		std::vector<Sequence> out;
+		for (const auto& kv : profiler.pairs) {
+			out.push_back({ { static_cast<int>(kv.first >> 32), static_cast<int>((kv.first >> 16) & 0xffff), -1 }, 2, kv.second });
+		}
+		for (const auto& kv : profiler.triples) {
+			out.push_back({ { static_cast<int>(kv.first >> 32), static_cast<int>((kv.first >> 16) & 0xffff), static_cast<int>(kv.first & 0xffff) }, 3, kv.second });
+		}
+
+		std::sort(out.begin(), out.end(), [](const Sequence& a, const Sequence& b) {
+			return a.count != b.count ? a.count > b.count : a.length > b.length;
+		});
+		return out;
+	}
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// SymbolTable
+
+void vm::executor::SymbolTable::load(std::istream& stream) {
+	int loc = 0;
+	std::string name;
+	while (stream >> loc >> name) {
+		if (name[0] == '@') symbols.push_back(std::make_pair(loc, name));
+	}
+	std::sort(symbols.begin(), symbols.end());
+}
+
+bool vm::executor::SymbolTable::empty() const {
+	return symbols.empty();
+}
+
+int vm::executor::SymbolTable::enclosing(int loc) const {
+	auto next = std::upper_bound(symbols.begin(), symbols.end(), loc, [](int loc, const std::pair<int, std::string>& symbol) { return loc < symbol.first; });
+	return static_cast<int>(next - symbols.begin()) - 1;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Profiler
+
+Profiler::Profiler() : counts(), ticks(), code(nullptr), last(nullptr), beforeLast(nullptr), lastTick(0) {}
+
+void Profiler::start(const Program& program) {
+	// Instructions decoded later still land inside the reserved capacity
+	code = program.instrs.data();
+	instrCounts.assign(program.instrs.capacity(), 0);
+	instrTicks.assign(program.instrs.capacity(), 0);
+
+	last = nullptr;
+	beforeLast = nullptr;
+	startTime = std::chrono::steady_clock::now();
+	stopTime = startTime;
+}
+
+void Profiler::stop(const Program& program, const SymbolTable& symbols) {
+	stopTime = std::chrono::steady_clock::now();
+
+	labels.clear();
+	for (const std::pair<int, std::string>& symbol : symbols.symbols) labels.push_back({ symbol.second, 0, 0 });
+	labels.push_back({ "(no label)", 0, 0 });
+
+	const int length = static_cast<int>(program.end - program.start);
+	for (size_t i = 0; i < program.instrs.size(); i++) {
+		const Instr& instr = program.instrs[i];
+
+		// Jumps the decoder added to join runs aren't in the program
+		if (instr.op == opcode::JMP && instr.loc < length && program.instrAt[instr.loc] != static_cast<int>(i)) continue;
+
+		counts[instr.op] += instrCounts[i];
+		ticks[instr.op] += instrTicks[i];
+
+		if (symbols.empty()) continue;
+		int label = symbols.enclosing(instr.loc);
+		LabelTotal& total = label < 0 ? labels.back() : labels[label];
+		total.count += instrCounts[i];
+		total.ticks += instrTicks[i];
+	}
+
+	std::stable_sort(labels.begin(), labels.end(), [](const LabelTotal& a, const LabelTotal& b) { return a.ticks > b.ticks; });
+	labels.erase(std::remove_if(labels.begin(), labels.end(), [](const LabelTotal& label) { return label.count == 0; }), labels.end());
+}
+
+uint64_t Profiler::retired() const {
+	uint64_t out = 0;
+	for (const uint64_t& count : counts) out += count;
+	return out;
+}
+
+double Profiler::seconds() const {
+	return std::chrono::duration<double>(stopTime - startTime).count();
+}
+
+void Profiler::report(std::ostream& stream) const {
+	const uint64_t total = retired();
+	const double secs = seconds();
+
+	stream << IO_PROFILE "Runtime (1,000,000 micros = 1 sec): " << std::chrono::duration_cast<std::chrono::microseconds>(stopTime - startTime).count() << "\n";
+	stream << "[PROFILE] Instructions retired: " << total << " (" << std::fixed << std::setprecision(0) << (secs > 0 ? total / secs : 0) << " per second)\n";
+
+	std::vector<int> ops;
+	for (int op = 0; op < execop::COUNT; op++) {
+		if (counts[op] > 0) ops.push_back(op);
+	}
+	std::sort(ops.begin(), ops.end(), [this](int a, int b) { return counts[a] > counts[b]; });
+
+	stream << "[PROFILE] " << std::left << std::setw(16) << "Opcode" << std::right << std::setw(14) << "Count" << std::setw(9) << "%"
+		<< std::setw(16) << tickUnit << std::setw(12) << "per op" << "\n";
+	for (const int& op : ops) {
+		stream << "[PROFILE] " << std::left << std::setw(16) << instrName(op) << std::right << std::setw(14) << counts[op]
+			<< std::setw(9) << std::setprecision(2) << 100.0 * counts[op] / total
+			<< std::setw(16) << ticks[op] << std::setw(12) << std::setprecision(1) << static_cast<double>(ticks[op]) / counts[op] << "\n";
+	}
+
+	if (!labels.empty()) {
+		stream << "[PROFILE] " << std::left << std::setw(24) << "Label" << std::right << std::setw(14) << "Count" << std::setw(9) << "%"
+			<< std::setw(16) << tickUnit << std::setw(9) << "%" << "\n";
+
+		uint64_t totalTicks = 0;
+		for (const LabelTotal& label : labels) totalTicks += label.ticks;
+		for (const LabelTotal& label : labels) {
+			stream << "[PROFILE] " << std::left << std::setw(24) << label.name << std::right << std::setw(14) << label.count
+				<< std::setw(9) << std::setprecision(2) << 100.0 * label.count / total
+				<< std::setw(16) << label.ticks << std::setw(9) << (totalTicks > 0 ? 100.0 * label.ticks / totalTicks : 0) << "\n";
+		}
+	}
+
+	stream << "[PROFILE] Superinstruction candidates (for VM/executorfusions.h):\n";
+	int shown = 0;
+	for (const Sequence& seq : sortedSequences(*this)) {
+		if (shown >= CANDIDATE_COUNT) break;
+
+		bool fusable = true;
+		for (int i = 0; i < seq.length - 1; i++) fusable = fusable && fallsThrough(seq.ops[i]);
+		if (!fusable || !(seq.ops[seq.length - 1] < opcode::count)) continue;
+
+		std::string name;
+		std::string args;
+		for (int i = 0; i < seq.length; i++) {
+			std::string mnemonic = instrName(seq.ops[i]);
+			std::transform(mnemonic.begin(), mnemonic.end(), mnemonic.begin(), ::toupper);
+			name += (i > 0 ? "_" : "") + mnemonic;
+			args += std::string(", opcode::") + enumName(seq.ops[i]);
+		}
+		stream << "[PROFILE] \tX(" << name << args << ") \\\t// " << seq.count << "\n";
+		shown++;
+	}
+
+	stream << std::defaultfloat << std::setprecision(6) << IO_NORM;
+}
+
+void Profiler::writeJson(std::ostream& stream) const {
+	const uint64_t total = retired();
+	const double secs = seconds();
+
+	stream << "{\n";
+	stream << "\t\"seconds\": " << secs << ",\n";
+	stream << "\t\"instructions\": " << total << ",\n";
+	stream << "\t\"instructionsPerSecond\": " << (secs > 0 ? total / secs : 0) << ",\n";
+	stream << "\t\"tickUnit\": \"" << tickUnit << "\",\n";
+
+	stream << "\t\"opcodes\": [";
+	bool first = true;
+	for (int op = 0; op < execop::COUNT; op++) {
+		if (counts[op] == 0) continue;
+		stream << (first ? "\n" : ",\n") << "\t\t{ \"name\": \"" << instrName(op) << "\", \"count\": " << counts[op] << ", \"ticks\": " << ticks[op] << " }";
+		first = false;
+	}
+	stream << "\n\t],\n";
+
+	stream << "\t\"labels\": [";
+	first = true;
+	for (const LabelTotal& label : labels) {
+		stream << (first ? "\n" : ",\n") << "\t\t{ \"name\": \"" << label.name << "\", \"count\": " << label.count << ", \"ticks\": " << label.ticks << " }";
+		first = false;
+	}
+	stream << "\n\t],\n";
+
+	stream << "\t\"sequences\": [";
+	first = true;
+	for (const Sequence& seq : sortedSequences(*this)) {
+		stream << (first ? "\n" : ",\n") << "\t\t{ \"ops\": [";
+		for (int i = 0; i < seq.length; i++) stream << (i > 0 ? ", " : "") << '"' << instrName(seq.ops[i]) << '"';
+		stream << "], \"count\": " << seq.count << " }";
+		first = false;
+	}
+	stream << "\n\t]\n";
+	stream << "}\n";
+}
\ No newline at end of file
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "executor.h"
+#include <chrono>
+#include <unordered_map>
+
+// Cycle counter for per-opcode estimates, falling back to steady_clock nanoseconds
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define Z_HAS_RDTSC 1
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define Z_HAS_RDTSC 1
+#else
+#define Z_HAS_RDTSC 0
+#endif
+
+namespace vm {
+	namespace executor {
+		// Code labels from the assembler's symbol file (see -symbols), by address
+		class SymbolTable {
+		public:
+			std::vector<std::pair<int, std::string>> symbols;
+
+			// Reads "address name" lines, keeping the @labels
+			void load(std::istream& stream);
+			bool empty() const;
+			// Index into symbols of the last label at or before loc, or -1
+			int enclosing(int loc) const;
+		};
+
+		// Collects everything -profile reports, fed one instruction at a time by the FEATURE_PROFILE executor instances
+		class Profiler {
+		public:
+			static constexpr const char* const tickUnit = Z_HAS_RDTSC ? "cycles" : "ns";
+
+			// Totals per opcode, filled in by stop()
+			uint64_t counts[execop::COUNT];
+			uint64_t ticks[execop::COUNT];	// Time from each instruction starting until the next one starts
+			// Dynamic counts of instructions that fell through into each other, keyed by seqKey
+			std::unordered_map<uint64_t, uint64_t> pairs;
+			std::unordered_map<uint64_t, uint64_t> triples;
+
+			struct LabelTotal {
+				std::string name;
+				uint64_t count;
+				uint64_t ticks;
+			};
+			// Totals per enclosing label, filled in by stop() when there are symbols
+			std::vector<LabelTotal> labels;
+
+			Profiler();
+
+			void start(const Program& program);
+			void stop(const Program& program, const SymbolTable& symbols);
+
+			inline void onInstr(const Instr* ip) {
+				uint64_t now = tick();
+
+				if (last != nullptr) {
+					instrTicks[last - code] += now - lastTick;
+
+					if (ip == last + 1) {
+						pairs[seqKey(last->op, ip->op)]++;
+						if (beforeLast != nullptr && last == beforeLast + 1) triples[seqKey(beforeLast->op, last->op, ip->op)]++;
+					} else {
+						last = nullptr;
+					}
+				}
+
+				instrCounts[ip - code]++;
+				beforeLast = last;
+				last = ip;
+				lastTick = tick(); // Leaves the profiler's own time out of the estimate
+			}
+
+			uint64_t retired() const;
+			double seconds() const;
+
+			// Human-readable summary, including superinstruction candidates in the EXEC_FUSIONS format
+			void report(std::ostream& stream) const;
+			void writeJson(std::ostream& stream) const;
+
+			static uint64_t seqKey(int a, int b, int c = -1) {
+				return (static_cast<uint64_t>(a) << 32) | (static_cast<uint64_t>(b) << 16) | static_cast<uint16_t>(c);
+			}
+
+		private:
+			// Per decoded instruction, indexed like Program::instrs
+			const Instr* code;
+			std::vector<uint64_t> instrCounts;
+			std::vector<uint64_t> instrTicks;
+
+			const Instr* last;
+			const Instr* beforeLast;
+			uint64_t lastTick;
+			std::chrono::steady_clock::time_point startTime;
+			std::chrono::steady_clock::time_point stopTime;
+
+			static inline uint64_t tick() {
+#if Z_HAS_RDTSC
+				return __rdtsc();
+#else
+				return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+			}
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include "sampler.h"
+#include <map>
+
+#if Z_HAS_SIGPROF
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+using vm::executor::Sampler;
+
+namespace {
+	// The sampler the SIGPROF handler reports to; there is only ever one run being sampled
+	Sampler* volatile activeSampler = nullptr;
+
+	std::string frameName(int loc, const vm::executor::SymbolTable& symbols) {
+		int label = symbols.enclosing(loc);
+		if (label >= 0) return symbols.symbols[label].second;
+		return "BYTE" + std::to_string(loc);
+	}
+}
+
+Sampler::Sampler() : current(nullptr), machine(nullptr), used(0), sampleCount(0), droppedCount(0) {}
+
+Sampler::~Sampler() {
+	stop();
+}
+
+bool Sampler::start(Machine& m, int interval) {
+#if Z_HAS_SIGPROF
+	machine = &m;
+	buffer.assign(BUFFER_WORDS, 0);
+	used = 0;
+	sampleCount = 0;
+	droppedCount = 0;
+	activeSampler = this;
+
+	struct sigaction action = {};
+	action.sa_handler = onSignal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGPROF, &action, nullptr);
+
+	struct itimerval timer = {};
+	timer.it_interval.tv_sec = interval / 1000000;
+	timer.it_interval.tv_usec = interval % 1000000;
+	timer.it_value = timer.it_interval;
+	setitimer(ITIMER_PROF, &timer, nullptr);
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void Sampler::stop() {
+#if Z_HAS_SIGPROF
+	if (activeSampler != this) return;
+
+	struct itimerval timer = {};
+	setitimer(ITIMER_PROF, &timer, nullptr);
+	signal(SIGPROF, SIG_IGN);
+	activeSampler = nullptr;
+#endif
+}
+
+int Sampler::samples() const {
+	return sampleCount;
+}
+
+int Sampler::dropped() const {
+	return droppedCount;
+}
+
+void Sampler::onSignal(int) {
+	Sampler* sampler = activeSampler;
+	if (sampler != nullptr) sampler->sample();
+}
+
+// Runs in the signal handler: no allocation, and nothing that trusts the program's stack contents
+void Sampler::sample() {
+	const Instr* ip = current.load(std::memory_order_relaxed);
+	if (ip == nullptr) return;
+
+	if (used + MAX_DEPTH + 2 > BUFFER_WORDS) {
+		droppedCount = droppedCount + 1;
+		return;
+	}
+
+	int* record = buffer.data() + used;
+	int depth = 0;
+	record[1] = ip->loc;
+
+	const char* const stackStart = machine->stack.start;
+	const char* const stackEnd = machine->stack.end;
+	char* const base = machine->base;
+
+	// Frames CALL pushed are on the ReturnStack, for as long as each one's frame is the one before it
+	const ReturnStack& returns = machine->returns;
+	types::word_t frame = machine->wordReg[register_::BP].word;
+	const unsigned int top = returns.depth;
+	for (unsigned int i = top; i > 0 && top - i < ReturnStack::SIZE && depth < MAX_DEPTH; i--) {
+		const ReturnStack::Entry& entry = returns.entries[(i - 1) & (ReturnStack::SIZE - 1)];
+		if (entry.frame != frame || entry.to == nullptr) break;
+		record[2 + depth++] = entry.to->loc;
+		frame = entry.caller;
+	}
+
+	// Then any built by hand
+	const char* bp = hostAddress(base, frame);
+
+	// Frames only ever move towards the start of the stack, which also stops the walk on garbage
+	while (depth < MAX_DEPTH && bp > stackStart && bp + 2 * sizeof(types::word_t) <= stackEnd) {
+		const types::word_t* frame = reinterpret_cast<const types::word_t*>(bp);
+		const char* savedBp = hostAddress(base, frame[0]);
+		if (savedBp < stackStart || savedBp >= bp) break;
+
+		record[2 + depth++] = frame[1];
+		bp = savedBp;
+	}
+
+	record[0] = depth;
+	used = used + depth + 2;
+	sampleCount = sampleCount + 1;
+}
+
+void Sampler::writeFolded(std::ostream& stream, const SymbolTable& symbols) const {
+	std::map<std::string, int> stacks;
+
+	for (int i = 0; i < used; i += buffer[i] + 2) {
+		const int depth = buffer[i];
+
+		std::string folded = "main";
+		for (int d = depth - 1; d >= 0; d--) folded += ";" + frameName(buffer[i + 2 + d], symbols);
+		folded += ";" + frameName(buffer[i + 1], symbols);
+
+		stacks[folded]++;
+	}
+
+	for (const std::pair<const std::string, int>& entry : stacks) {
+		stream << entry.first << " " << entry.second << "\n";
+	}
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "profiler.h"
+#include <atomic>
+
+// Sampling needs a POSIX profiling timer (setitimer + SIGPROF)
+#if defined(__unix__) || defined(__APPLE__)
+#define Z_HAS_SIGPROF 1
+#else
+#define Z_HAS_SIGPROF 0
+#endif
+
+namespace vm {
+	namespace executor {
+		// Low-overhead alternative to Profiler for long runs
+		// The FEATURE_SAMPLE executor instances publish the current instruction, and a SIGPROF timer records it along with
+		// the call stack, read from the Machine's ReturnStack as far as CALL made it, then walked through the frames the
+		// calling convention saves on the stack:
+		//   BP + 0: BP to return to
+		//   BP + 4: IP to return to
+		class Sampler {
+		public:
+			static constexpr int MAX_DEPTH = 128;
+			// Samples are stored as [depth, loc, return locs...] until the buffer fills, since the signal handler can't allocate
+			static constexpr int BUFFER_WORDS = 1 << 22;
+
+			std::atomic<const Instr*> current;
+
+			Sampler();
+			~Sampler();
+
+			// Starts the timer, sampling every interval microseconds
+			// Returns false if sampling isn't supported on this platform
+			bool start(Machine& m, int interval);
+			void stop();
+
+			int samples() const;
+			int dropped() const;
+
+			// One line per distinct stack, "outermost;...;innermost count", as read by flamegraph.pl and similar tools
+			// Frames are named by enclosing label if there are symbols, otherwise by byte offset
+			void writeFolded(std::ostream& stream, const SymbolTable& symbols) const;
+
+		private:
+			Machine* machine;
+			std::vector<int> buffer;
+			volatile int used;
+			volatile int sampleCount;
+			volatile int droppedCount;
+
+			void sample();
+			static void onSignal(int);
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,279 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+using vm::executor::Scheduler;
+using vm::executor::GreenThread;
+using vm::executor::Instr;
+
+Scheduler::Scheduler(Machine& mainIn, const ExecutorSettings& execSettingsIn, Worker workerIn, unsigned int workers) :
+	main(mainIn), execSettings(execSettingsIn), worker(workerIn), live(1), queued(0), active(1), started(false), failed(false), retired(0) {
+	for (unsigned int i = 0; i < std::max(workers, 1u); i++) queues.push_back(std::unique_ptr<Queue>(new Queue()));
+
+	threads.push_back(GreenThread());
+	threads.back().state = GreenThread::RUNNING;
+	main.scheduler = this;
+	main.thread = &threads.back();
+	main.worker = 0;
+}
+
+Scheduler::~Scheduler() {
+	// Workers are only still running here if main threw, and stop at their next HALT
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		failed = true;
+	}
+	idle.notify_all();
+
+	for (std::thread& thread : pool) {
+		if (thread.joinable()) thread.join();
+	}
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Handlers
+
+void Scheduler::spawn(Machine& m, const Instr* ip) {
+	using namespace types;
+
+	std::unique_lock<std::mutex> guard(lock);
+
+	char* stack;
+	if (!freeStacks.empty()) {
+		stack = freeStacks.back();
+		freeStacks.pop_back();
+	} else {
+		// The main thread always keeps at least one slice's worth
+		stack = m.stack.carve(execSettings.threadStackSize);
+		if (stack == nullptr) throw ExecutorException(ExecutorException::THREAD_LIMIT, ip[1].loc);
+	}
+
+	threads.push_back(GreenThread());
+	GreenThread* thread = &threads.back();
+	thread->id = static_cast<int>(threads.size()) - 1;
+	thread->stack = stack;
+
+	// The new thread starts with a copy of the spawner's registers, its own ID included, on its own stack
+	ip->a.word->int_ = thread->id;
+	save(m, thread, ip->imm);
+	thread->wordReg[register_::BP].word = wordAddress(m.base, stack);
+	thread->state = GreenThread::RUNNABLE;
+
+	live++;
+	queued++;
+	push(m.worker, thread, false);
+
+	const bool first = !started;
+	started = true;
+	guard.unlock();
+
+	if (first) start();
+}
+
+const Instr* Scheduler::join(Machine& m, const Instr* ip) {
+	std::lock_guard<std::mutex> guard(lock);
+
+	const int id = ip->b.word->int_;
+	if (id < 0 || id >= static_cast<int>(threads.size())) throw ExecutorException(ExecutorException::INVALID_THREAD, ip[1].loc);
+
+	GreenThread& target = threads[id];
+	if (target.state == GreenThread::DONE) {
+		ip->a.word->word = target.result;
+		return ip + 1;
+	}
+	if (&target == m.thread) throw ExecutorException(ExecutorException::DEADLOCK, ip[1].loc);
+
+	// Runs the JOIN again once woken, which then finds the target done
+	GreenThread* thread = m.thread;
+	save(m, thread, ip->loc);
+	thread->state = GreenThread::BLOCKED;
+	thread->blockedAt = ip[1].loc;
+	target.joiners.push_back(thread);
+
+	m.thread = nullptr;
+	active--;
+	return m.code + m.program.haltIndex;
+}
+
+const Instr* Scheduler::yield(Machine& m, const Instr* ip) {
+	std::lock_guard<std::mutex> guard(lock);
+
+	// To the front, so this worker runs everything else it has first
+	GreenThread* thread = m.thread;
+	save(m, thread, ip[1].loc);
+	thread->state = GreenThread::RUNNABLE;
+	queued++;
+	push(m.worker, thread, true);
+
+	m.thread = nullptr;
+	active--;
+	return m.code + m.program.haltIndex;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+const Instr* Scheduler::next(Machine& m) {
+	using namespace types;
+
+	std::unique_lock<std::mutex> guard(lock);
+
+	GreenThread* thread = m.thread;
+	if (thread != nullptr) {
+		thread->state = GreenThread::DONE;
+		thread->result = m.wordReg[register_::W0].word;
+		for (GreenThread* joiner : thread->joiners) {
+			joiner->state = GreenThread::RUNNABLE;
+			queued++;
+			push(m.worker, joiner, false);
+		}
+		thread->joiners.clear();
+		if (thread->stack != nullptr) freeStacks.push_back(thread->stack);
+
+		m.thread = nullptr;
+		active--;
+		if (--live == 0) idle.notify_all();
+	}
+
+	while (true) {
+		if (failed || live == 0) return nullptr;
+
+		if (queued == 0 && active == 0) {
+			// Nothing left to run, and nothing running that could wake what's blocked
+			int loc = 0;
+			for (const GreenThread& blocked : threads) {
+				if (blocked.state == GreenThread::BLOCKED) {
+					loc = blocked.blockedAt;
+					break;
+				}
+			}
+			failed = true;
+			idle.notify_all();
+			throw ExecutorException(ExecutorException::DEADLOCK, loc);
+		}
+
+		if (queued == 0) {
+			idle.wait(guard);
+			continue;
+		}
+
+		guard.unlock();
+		thread = take(m.worker);
+		guard.lock();
+
+		if (thread != nullptr) {
+			queued--;
+			active++;
+			thread->state = GreenThread::RUNNING;
+			load(m, thread);
+			m.thread = thread;
+			guard.unlock();
+			return m.program.jumpTarget(thread->resume);
+		}
+
+		// Counted but not in a queue yet, or taken by another worker first
+		guard.unlock();
+		std::this_thread::yield();
+		guard.lock();
+	}
+}
+
+void Scheduler::attach(Machine& m, unsigned int index) {
+	m.scheduler = this;
+	m.thread = nullptr;
+	m.worker = index;
+	m.ioLock = &ioLock;
+}
+
+void Scheduler::fail(std::exception_ptr e) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (!error) error = e;
+		failed = true;
+	}
+	idle.notify_all();
+}
+
+void Scheduler::addRetired(uint64_t count) {
+	std::lock_guard<std::mutex> guard(lock);
+	retired += count;
+}
+
+bool Scheduler::spawned() {
+	std::lock_guard<std::mutex> guard(lock);
+	return started;
+}
+
+uint64_t Scheduler::finish() {
+	for (std::thread& thread : pool) thread.join();
+	pool.clear();
+
+	if (error) std::rethrow_exception(error);
+	return retired;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+GreenThread* Scheduler::take(unsigned int index) {
+	// Newest first from our own queue
+	{
+		Queue& own = *queues[index];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.threads.empty()) {
+			GreenThread* thread = own.threads.back();
+			own.threads.pop_back();
+			return thread;
+		}
+	}
+
+	// Oldest first from everyone else's
+	const size_t count = queues.size();
+	for (size_t i = 1; i < count; i++) {
+		Queue& victim = *queues[(index + i) % count];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.threads.empty()) {
+			GreenThread* thread = victim.threads.front();
+			victim.threads.pop_front();
+			return thread;
+		}
+	}
+
+	return nullptr;
+}
+
+// Called with lock held, after counting the thread in queued
+void Scheduler::push(unsigned int index, GreenThread* thread, bool front) {
+	{
+		Queue& own = *queues[index];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (front) {
+			own.threads.push_front(thread);
+		} else {
+			own.threads.push_back(thread);
+		}
+	}
+	idle.notify_one();
+}
+
+void Scheduler::save(Machine& m, GreenThread* thread, int resume) {
+	std::copy(m.wordReg, m.wordReg + register_::COUNT, thread->wordReg);
+	std::copy(m.byteReg, m.byteReg + register_::COUNT, thread->byteReg);
+	std::copy(m.vecReg, m.vecReg + register_::NUM_VECTOR_REGISTERS, thread->vecReg);
+	thread->resume = resume;
+}
+
+void Scheduler::load(Machine& m, GreenThread* thread) {
+	std::copy(thread->wordReg, thread->wordReg + register_::COUNT, m.wordReg);
+	std::copy(thread->byteReg, thread->byteReg + register_::COUNT, m.byteReg);
+	std::copy(thread->vecReg, thread->vecReg + register_::NUM_VECTOR_REGISTERS, m.vecReg);
+	// The thread's frames are on its own stack, so nothing the last one called applies
+	m.returns.clear();
+}
+
+// Starts the other workers, at the first SPAWN
+void Scheduler::start() {
+	if (queues.size() > 1) {
+		main.ioLock = &ioLock;
+		main.heap->shared = true;
+	}
+	for (unsigned int i = 1; i < queues.size(); i++) pool.push_back(std::thread(worker, std::ref(*this), i));
+}
\ No newline at end of file
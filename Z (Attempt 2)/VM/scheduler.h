@@ -0,0 +1,108 @@
+#pragma once
+
+#include "executor.h"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <thread>
+
+namespace vm {
+	namespace executor {
+		// A VM thread: everything needed to suspend it on one worker and resume it on another
+		struct GreenThread {
+			enum State {
+				RUNNABLE,	// In a worker's queue
+				RUNNING,
+				BLOCKED,	// Joining a thread that hasn't finished
+				DONE
+			};
+
+			int id;
+			State state;
+			int resume;			// Byte offset to continue from, looked up again on whichever worker runs it next
+			int blockedAt;		// Where a deadlock is reported from while blocked
+			types::WordVal wordReg[register_::COUNT];
+			types::ByteVal byteReg[register_::COUNT];
+			types::VecVal vecReg[register_::NUM_VECTOR_REGISTERS];
+			char* stack;		// Its slice of the Stack, or nullptr for the main thread
+			types::word_t result;	// W0 when it halted
+			std::vector<GreenThread*> joiners;
+		};
+
+		// Runs green threads (SPAWN, JOIN, YIELD) M:N on a pool of workers
+		// Every worker has its own Machine, and its own decode of the program against that Machine's registers, so a
+		// thread is moved between workers by copying its register file. Threads run until they halt, yield or block on a
+		// join, at which point the engine reaches HALT and asks next() for another.
+		// Workers push the threads they spawn or wake onto the back of their own queue and take from the back, so each one
+		// works depth-first; idle workers steal from the front of the others' queues, taking the oldest (and for
+		// divide-and-conquer programs, largest) piece of work.
+		// Each spawned thread gets threadStackSize bytes carved from the top of the Stack's limit, and the main thread keeps
+		// the rest. With Z_STACK_TRAP each of them ends in a guard, so overflowing one is a stack overflow rather than
+		// writing over the next. Worker threads only start at the first SPAWN, so programs that never spawn run exactly
+		// as before.
+		class Scheduler {
+		public:
+			// Sets up a worker's Machine and runs an engine on it until next() returns nullptr
+			typedef void (*Worker)(Scheduler& scheduler, unsigned int index);
+
+			Machine& main;
+			const ExecutorSettings& execSettings;
+
+			// Takes on main's registers as the main thread; workers is 1 for instrumented runs
+			Scheduler(Machine& mainIn, const ExecutorSettings& execSettingsIn, Worker workerIn, unsigned int workers);
+			~Scheduler();
+
+			// Handlers, see executorops.h
+			void spawn(Machine& m, const Instr* ip);
+			const Instr* join(Machine& m, const Instr* ip);
+			const Instr* yield(Machine& m, const Instr* ip);
+
+			// Called by the engines on HALT: finishes the thread that reached it, if it wasn't suspended, then switches m to
+			// the next thread to run. Returns where to continue, or nullptr once every thread is done
+			const Instr* next(Machine& m);
+
+			// Gives a worker's Machine its scheduling state
+			void attach(Machine& m, unsigned int index);
+			// Stops every worker because of an exception on one of them
+			void fail(std::exception_ptr e);
+			void addRetired(uint64_t count);
+			// Whether the program has ever spawned a thread
+			bool spawned();
+
+			// Waits for the workers, then rethrows the first exception any of them had
+			// Returns the instructions retired on workers other than main
+			uint64_t finish();
+
+		private:
+			struct Queue {
+				std::mutex lock;
+				std::deque<GreenThread*> threads;
+			};
+
+			Worker worker;
+			std::vector<std::unique_ptr<Queue>> queues;		// One per worker
+			std::vector<std::thread> pool;					// Workers other than main
+			std::mutex ioLock;
+
+			// Everything below is guarded by lock
+			std::mutex lock;
+			std::condition_variable idle;
+			std::deque<GreenThread> threads;	// Indexed by ID, never moves
+			std::vector<char*> freeStacks;
+			int live;		// Threads not yet DONE
+			int queued;		// Threads in queues, counted before they're pushed and after they're taken
+			int active;		// Threads running on a worker
+			bool started;
+			bool failed;
+			std::exception_ptr error;
+			uint64_t retired;
+
+			GreenThread* take(unsigned int index);
+			void push(unsigned int index, GreenThread* thread, bool front);
+			void save(Machine& m, GreenThread* thread, int resume);
+			void load(Machine& m, GreenThread* thread);
+			void start();
+		};
+	}
+}
\ No newline at end of file
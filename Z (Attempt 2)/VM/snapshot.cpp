@@ -0,0 +1,165 @@
+#include "snapshot.h"
+#include "scheduler.h"
+
+#include <algorithm>
+#include <fstream>
+
+using vm::executor::Snapshot;
+using vm::executor::Instr;
+using std::cout;
+
+namespace {
+	constexpr char MAGIC[4] = { 'Z', 'S', 'N', '1' };
+	constexpr uint32_t MAX_REGIONS = static_cast<uint32_t>(vm::executor::Memory::SPAN / vm::executor::Memory::GRANULE);
+
+	// Anything that would change what the header or the image mean changes this
+	uint32_t layout(size_t headerSize) {
+		using namespace vm::executor;
+		return static_cast<uint32_t>(headerSize) << 16 ^ static_cast<uint32_t>(Memory::GRANULE >> 8) ^ Heap::CLASS_COUNT << 8 ^ register_::COUNT;
+	}
+}
+
+Snapshot::Snapshot() : stackSize(0), stackLimit(0), header(), path(nullptr), op(0) {}
+
+void Snapshot::arm(Machine& m, const SymbolTable& symbols, const char* label, const char* pathIn) {
+	const std::string name = label[0] == '@' ? std::string(label) : "@" + std::string(label);
+
+	for (const std::pair<int, std::string>& symbol : symbols.symbols) {
+		if (symbol.second != name || symbol.first < 0 || symbol.first >= m.program.end - m.program.start) continue;
+
+		const Instr* instr = m.program.jumpTarget(symbol.first);
+		op = instr->op;
+		path = pathIn;
+		m.program.setOp(instr, execop::SNAPSHOT);
+		m.snapshot = this;
+		return;
+	}
+
+	throw ExecutorException(ExecutorException::SNAPSHOT, -1, "no label " + name + " in the program's symbols (assembled with -symbols?)");
+}
+
+const Instr* Snapshot::take(Machine& m, const Instr* ip) {
+	// Only ever taken once, however this goes
+	m.program.setOp(ip, op);
+	m.snapshot = nullptr;
+
+	if (!Z_SANDBOX) throw ExecutorException(ExecutorException::SNAPSHOT, ip->loc, "snapshots need a 64-bit host");
+	if (m.scheduler->spawned()) throw ExecutorException(ExecutorException::SNAPSHOT, ip->loc, "the program has spawned threads");
+
+	// Output from before the label belongs to this run, not the restored one
+	m.output->flush();
+
+	Memory& memory = m.program.memory;
+	memory.commitStack();
+	const std::vector<Memory::Region>& regions = memory.regions();
+
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.layout = layout(sizeof(Header));
+	header.loc = ip->loc;
+	header.length = static_cast<int32_t>(m.program.end - m.program.start);
+	header.stackSize = m.scheduler->execSettings.stackSize;
+	header.stackLimit = m.scheduler->execSettings.stackLimit;
+	header.stackAt = memory.stackOffset();
+	header.stackUsed = memory.stackUsed();
+	header.regionCount = static_cast<uint32_t>(regions.size());
+	header.top = memory.mark();
+	std::copy(m.wordReg, m.wordReg + register_::COUNT, header.wordReg);
+	std::copy(m.byteReg, m.byteReg + register_::COUNT, header.byteReg);
+	std::copy(m.vecReg, m.vecReg + register_::NUM_VECTOR_REGISTERS, header.vecReg);
+	header.heap = m.heap->save();
+
+	std::fstream file;
+	file.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) throw ExecutorException(ExecutorException::SNAPSHOT, ip->loc, "could not open \"" + std::string(path) + "\"");
+
+	// Every region at its own offset, leaving the gaps between them for the file system to skip, along with the part of
+	// the stack that was never reached
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	for (const Memory::Region& region : regions) {
+		uint64_t size = region.size;
+		if (region.offset == header.stackAt && header.stackUsed > region.offset) size = std::min<uint64_t>(size, header.stackUsed - region.offset);
+		file.seekp(region.offset);
+		file.write(m.base + region.offset, static_cast<std::streamsize>(size));
+	}
+	file.seekp(static_cast<std::streamoff>(header.top));
+	file.write(reinterpret_cast<const char*>(regions.data()), regions.size() * sizeof(Memory::Region));
+	if (!file) throw ExecutorException(ExecutorException::SNAPSHOT, ip->loc, "could not write \"" + std::string(path) + "\"");
+
+	m.streamOut << IO_MAIN "Snapshot taken at BYTE" << ip->loc << " and written to \"" << path << "\"" IO_NORM "\n";
+	return ip;
+}
+
+bool Snapshot::load(const char* pathIn, Program& program) {
+	std::fstream file;
+	file.open(pathIn, std::ios::in | std::ios::binary);
+	if (!file.is_open()) return false;
+
+	Header in;
+	file.read(reinterpret_cast<char*>(&in), sizeof(in));
+	if (!file || std::memcmp(in.magic, MAGIC, sizeof(MAGIC)) != 0 || in.layout != layout(sizeof(Header))) return false;
+	if (in.length <= 0 || in.loc < 0 || in.loc >= in.length || in.top > Memory::SPAN || in.regionCount == 0 || in.regionCount > MAX_REGIONS) return false;
+
+	std::vector<Memory::Region> regions(in.regionCount);
+	file.seekg(static_cast<std::streamoff>(in.top));
+	file.read(reinterpret_cast<char*>(regions.data()), regions.size() * sizeof(Memory::Region));
+	if (!file) return false;
+	file.close();
+
+	// The bytecode comes first, and the stack has to be the one the settings describe
+	const Memory::Region& code = regions.front();
+	if (code.offset != Memory::PROGRAM || code.size < static_cast<uint64_t>(in.length) + Program::FILLER_SIZE) return false;
+	const uint32_t capacity = std::max(in.stackSize, in.stackLimit);
+	auto stack = std::find_if(regions.begin(), regions.end(), [&](const Memory::Region& region) { return region.offset == in.stackAt; });
+	if (stack == regions.end() || stack->size != capacity) return false;
+
+	if (!program.memory.restore(pathIn, in.top, regions, in.stackAt, in.stackUsed)) return false;
+
+	header = in;
+	stackSize = in.stackSize;
+	stackLimit = in.stackLimit;
+	program.start = program.memory.base + Memory::PROGRAM;
+	program.ip = program.start;
+	program.end = program.start + in.length;
+	program.resume = this;
+	return true;
+}
+
+int Snapshot::resume(Machine& m, Heap& heap) {
+	std::copy(header.wordReg, header.wordReg + register_::COUNT, m.wordReg);
+	std::copy(header.byteReg, header.byteReg + register_::COUNT, m.byteReg);
+	std::copy(header.vecReg, header.vecReg + register_::NUM_VECTOR_REGISTERS, m.vecReg);
+	heap.restore(header.heap);
+	return static_cast<int>(m.program.jumpTarget(header.loc) - m.program.instrs.data());
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+int vm::executor::restore(const char* const& path, ExecutorSettings& execSettings) {
+	cout << IO_MAIN "Attempting to restore snapshot \"" << path << "\"\n" IO_NORM;
+
+	try {
+		// Outlives the program, which points back at it
+		Snapshot snapshot;
+		Program program;
+		if (!snapshot.load(path, program)) {
+			cout << IO_ERR "Could not restore \"" << path << "\", which is missing or not a snapshot from this build" IO_NORM IO_END;
+			return 1;
+		}
+
+		// The stack is the snapshot's, and its label has already been reached
+		ExecutorSettings restoreSettings = execSettings;
+		restoreSettings.stackSize = snapshot.stackSize;
+		restoreSettings.stackLimit = snapshot.stackLimit;
+		restoreSettings.snapshotLabel = nullptr;
+
+		int out = vm::executor::exec_(program, restoreSettings, std::cout, std::cin, nullptr);
+		cout << IO_MAIN "Execution finished with code: " << out << IO_NORM IO_END;
+		return out;
+	} catch (ExecutorException& e) {
+		cout << IO_ERR "Error during execution at BYTE" << e.loc << " : " << e.what() << IO_NORM IO_END;
+	} catch (std::exception& e) {
+		cout << IO_ERR "An unknown error ocurred during execution. This error is most likely an issue with the c++ executor code, not your code. Sorry. The provided error message is as follows:\n" << e.what() << IO_NORM IO_END;
+	}
+
+	return 1;
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "executor.h"
+#include "profiler.h"
+
+namespace vm {
+	namespace executor {
+		// The state of an execution when it reached a label, written by -snapshotat and continued from by -restore
+		// A snapshot file is a Header, then the image of the program's Memory with every region at its own offset (the
+		// bytecode with its globals as they were, the stack, the heap), then the list of those regions. Word addresses are
+		// offsets into Memory, so mapping the image back in at the same offsets is all registers and heap need.
+		// Only one thread's state fits: snapshots are taken on a single worker, and not once the program has spawned.
+		class Snapshot {
+		public:
+			unsigned int stackSize;		// Restored executions must use these, so their Stack is the one in the image
+			unsigned int stackLimit;
+
+			Snapshot();
+
+			// Makes the instruction at label (an @label from the program's symbols) take the snapshot, writing it to path
+			// Throws ExecutorException if the program has no such label
+			void arm(Machine& m, const SymbolTable& symbols, const char* label, const char* path);
+			// Writes the snapshot, then puts the label's instruction back, returning it to run next
+			const Instr* take(Machine& m, const Instr* ip);
+
+			// Maps the snapshot at path into program, which must have nothing in its Memory yet
+			// Returns false, leaving program empty, if it isn't a snapshot this build wrote
+			bool load(const char* path, Program& program);
+			// Gives a Machine set up by exec_ over the loaded program the registers and heap from the snapshot
+			// Returns the index into program.instrs to continue from; the program must be decoded
+			int resume(Machine& m, Heap& heap);
+
+		private:
+			struct Header {
+				char magic[4];
+				uint32_t layout;	// Sizes that must match between the build that wrote it and the one reading it
+				int32_t loc;		// Of the label
+				int32_t length;		// Of the bytecode
+				uint32_t stackSize;
+				uint32_t stackLimit;
+				uint32_t stackAt;	// Offset of the Stack
+				uint32_t regionCount;
+				uint64_t top;		// Where the image ends and the regions start
+				uint64_t stackUsed;	// See Memory::stackUsed
+				types::WordVal wordReg[register_::COUNT];
+				types::ByteVal byteReg[register_::COUNT];
+				types::VecVal vecReg[register_::NUM_VECTOR_REGISTERS];
+				Heap::State heap;
+			};
+
+			Header header;
+			const char* path;
+			uint16_t op;		// Of the label's instruction
+		};
+
+		// Continues the execution in the snapshot at path, like exec does a program
+		int restore(const char* const& path, ExecutorSettings& execSettings);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include "executor.h"
+
+#include <string>
+
+using vm::executor::ExecutorException;
+
+const char* const vm::executor::Program::verifierBuilt = __DATE__ " " __TIME__;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Load-time verification of the bytecode
+//
+// Nothing in the bytecode says where the globals end and the instructions start, so verification walks what the
+// decoder would: straight-line runs from the first instruction and from every static jump, call and spawn target they
+// contain. Every byte an instruction covers is marked with where that instruction starts, so a target (or a run
+// falling through) landing inside an instruction is caught wherever it's found.
+//
+// Without it the decoder checks each run as it decodes it, turning anything it can't run into a placeholder that
+// throws when reached, so a malformed file runs until it gets there, and a jump into the middle of an instruction
+// decodes its operand bytes as opcodes. Verification rejects both before anything runs, and lets the decoder skip its
+// checks for every run it walked.
+
+namespace {
+	// The one word argument of JMP, JMP_Z, JMP_NZ and SPAWN, and the first of CALL, is an address in the program
+	bool hasTarget(int op) {
+		using namespace opcode;
+		return op == JMP || op == JMP_Z || op == JMP_NZ || op == CALL || op == SPAWN;
+	}
+
+	std::string name(int op) {
+		return "\"" + std::string(opcode::strings[op]) + "\"";
+	}
+
+	ExecutorException invalid(int loc, const std::string& what) {
+		return ExecutorException(ExecutorException::INVALID_BYTECODE, loc, what);
+	}
+
+	struct Target {
+		int from;		// Of the instruction with the target
+		types::word_t to;
+	};
+}
+
+void vm::executor::Program::verify() {
+	using namespace types;
+	using namespace opcode;
+
+	const int length = static_cast<int>(end - start);
+	if (length < format::GLOBAL_TABLE_LOCATION) throw invalid(0, "too short to hold the address of the first instruction");
+
+	goto_(format::FIRST_INSTR_ADDR_LOCATION);
+	word_t first = 0;
+	read<word_t>(&first);
+
+	// Where the instruction covering each byte starts, or -1
+	std::vector<int> owner(length, -1);
+	std::vector<Target> pending = { { format::FIRST_INSTR_ADDR_LOCATION, first } };
+
+	opcode_t opcode = 0;
+	reg_t rid = 0;
+	word_t word = 0;
+
+	while (!pending.empty()) {
+		const Target target = pending.back();
+		pending.pop_back();
+
+		// Jumping to the end halts, like running off it
+		const std::string what = target.from == format::FIRST_INSTR_ADDR_LOCATION ? "the first instruction" : name(static_cast<uint8_t>(start[target.from])) + " target";
+		if (target.to < format::GLOBAL_TABLE_LOCATION || target.to > length) throw invalid(target.from, what + " at BYTE" + std::to_string(target.to) + " is outside the program");
+		if (target.to == length || owner[target.to] == target.to) continue;
+		if (owner[target.to] >= 0) throw invalid(target.from, what + " at BYTE" + std::to_string(target.to) + " is inside the instruction at BYTE" + std::to_string(owner[target.to]));
+
+		goto_(target.to);
+		while (ip < end && owner[ip - start] < 0) {
+			const int loc = static_cast<int>(ip - start);
+
+			read<opcode_t>(&opcode);
+			if (opcode >= count) throw invalid(loc, "unknown opcode " + std::to_string(opcode));
+			if (opcode >= GLOBAL_BREAK) throw invalid(loc, name(opcode) + " after the first instruction");
+
+			int size = sizeof(opcode_t);
+			for (const int& arg : args[opcode]) {
+				switch (static_cast<ArgType>(arg)) {
+					case ArgType::ARG_WORD_REG:
+					case ArgType::ARG_BYTE_REG:
+					case ArgType::ARG_VEC_REG:
+						size += sizeof(reg_t);
+						break;
+					case ArgType::ARG_WORD:
+						size += sizeof(word_t);
+						break;
+					case ArgType::ARG_BYTE:
+						size += sizeof(byte_t);
+						break;
+					default:
+						break;
+				}
+			}
+			if (size > length - loc) throw invalid(loc, name(opcode) + " needs " + std::to_string(size) + " bytes, but the program ends after " + std::to_string(length - loc));
+
+			for (int i = loc; i < loc + size; i++) {
+				if (owner[i] >= 0) throw invalid(loc, name(opcode) + " overlaps the instruction at BYTE" + std::to_string(owner[i]));
+				owner[i] = loc;
+			}
+
+			int argIndex = 0;
+			bool targetRead = false;
+			for (const int& arg : args[opcode]) {
+				argIndex++;
+				switch (static_cast<ArgType>(arg)) {
+					case ArgType::ARG_WORD_REG:
+					case ArgType::ARG_BYTE_REG:
+						read<reg_t>(&rid);
+						if (rid >= register_::COUNT) {
+							const char* kind = static_cast<ArgType>(arg) == ArgType::ARG_WORD_REG ? " word" : " byte";
+							throw invalid(loc, name(opcode) + " argument " + std::to_string(argIndex) + " is register " + std::to_string(rid) + ", but there are " + std::to_string(register_::COUNT) + kind + " registers");
+						}
+						break;
+
+					case ArgType::ARG_VEC_REG:
+						read<reg_t>(&rid);
+						if (rid >= register_::NUM_VECTOR_REGISTERS) {
+							throw invalid(loc, name(opcode) + " argument " + std::to_string(argIndex) + " is register " + std::to_string(rid) + ", but there are " + std::to_string(register_::NUM_VECTOR_REGISTERS) + " vector registers");
+						}
+						break;
+
+					case ArgType::ARG_WORD:
+						read<word_t>(&word);
+						if (hasTarget(opcode) && !targetRead) pending.push_back({ loc, word });
+						targetRead = true;
+						break;
+
+					case ArgType::ARG_BYTE:
+						ip += sizeof(byte_t);
+						break;
+
+					default:
+						break;
+				}
+			}
+		}
+	}
+
+	verified = true;
+}
\ No newline at end of file
@@ -16,7 +16,27 @@ int main(int argc, const char* args[]) {
 		"-noprofile",
 		"-stacksize",
 		"-compile",
-		"-disassemble"
+		"-disassemble",
+		"-dispatch",
+		"-fuse",
+		"-nofuse",
+		"-profileout",
+		"-symbols",
+		"-nosymbols",
+		"-sample",
+		"-sampleinterval",
+		"-jit",
+		"-nojit",
+		"-aot",
+		"-execbatch",
+		"-threads",
+		"-threadstack",
+		"-cache",
+		"-stacklimit",
+		"-snapshotat",
+		"-restore",
+		"-verify",
+		"-noverify"
 	};
 
 	vm::assembler::AssemblerSettings assemblerSettings;
@@ -92,6 +112,7 @@ int main(int argc, const char* args[]) {
 					return 1;
 				} else {
 					executorSettings.stackSize = uInt;
+					i++;
 				}
 				break;
 
@@ -114,6 +135,176 @@ int main(int argc, const char* args[]) {
 					i++;
 				}
 				break;
+
+			case 10: // -dispatch
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting dispatch engine" IO_NORM IO_END;
+					return 1;
+				} else {
+					int dispatch = stringMatchAt(args[i + 1], vm::executor::dispatchStrings, ARR_LEN(vm::executor::dispatchStrings));
+					if (dispatch < 0) {
+						cout << IO_ERR "Unknown dispatch engine: " << args[i + 1] << IO_NORM IO_END;
+						return 1;
+					}
+					executorSettings.dispatch = static_cast<vm::executor::Dispatch>(dispatch);
+					i++;
+				}
+				break;
+
+			case 11: // -fuse
+				executorSettings.fuse = true;
+				break;
+
+			case 12: // -nofuse
+				executorSettings.fuse = false;
+				break;
+
+			case 13: // -profileout
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting profile output" IO_NORM IO_END;
+					return 1;
+				} else {
+					executorSettings.profilePath = args[i + 1];
+					i++;
+				}
+				break;
+
+			case 14: // -symbols
+				assemblerSettings.symbols = true;
+				break;
+
+			case 15: // -nosymbols
+				assemblerSettings.symbols = false;
+				break;
+
+			case 16: // -sample
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for sampling" IO_NORM IO_END;
+					return 1;
+				} else {
+					executorSettings.samplePath = args[i + 1];
+					i++;
+				}
+				break;
+
+			case 17: // -sampleinterval
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting sample interval" IO_NORM IO_END;
+					return 1;
+				} else if (parseUInt(args[i + 1], uInt) || uInt == 0) {
+					cout << IO_ERR "Invalid sample interval" IO_NORM IO_END;
+					return 1;
+				} else {
+					executorSettings.sampleInterval = uInt;
+					i++;
+				}
+				break;
+
+			case 18: // -jit
+				executorSettings.jit = true;
+				break;
+
+			case 19: // -nojit
+				executorSettings.jit = false;
+				break;
+
+			case 20: // -aot
+				if (argc - i < 3) {
+					cout << IO_ERR "Not enough arguments for ahead-of-time translation" IO_NORM IO_END;
+					return 1;
+				} else {
+					if (vm::aot::translate(args[i + 1], args[i + 2], executorSettings)) return 1;
+					i += 2;
+				}
+				break;
+
+			case 21: // -execbatch
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for batch execution" IO_NORM IO_END;
+					return 1;
+				} else {
+					if (vm::executor::execBatch(args[i + 1], executorSettings)) return 1;
+					i++;
+				}
+				break;
+
+			case 22: // -threads
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting thread count" IO_NORM IO_END;
+					return 1;
+				} else if (parseUInt(args[i + 1], uInt)) {
+					cout << IO_ERR "Invalid thread count" IO_NORM IO_END;
+					return 1;
+				} else {
+					executorSettings.threads = uInt;
+					i++;
+				}
+				break;
+
+			case 23: // -threadstack
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting thread stack size" IO_NORM IO_END;
+					return 1;
+				} else if (parseUInt(args[i + 1], uInt) || uInt == 0) {
+					cout << IO_ERR "Invalid thread stack size" IO_NORM IO_END;
+					return 1;
+				} else {
+					executorSettings.threadStackSize = uInt;
+					i++;
+				}
+				break;
+
+			case 24: // -cache
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting cache directory" IO_NORM IO_END;
+					return 1;
+				} else {
+					executorSettings.cachePath = args[i + 1];
+					i++;
+				}
+				break;
+
+			case 25: // -stacklimit
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for setting stack limit" IO_NORM IO_END;
+					return 1;
+				} else if (parseUInt(args[i + 1], uInt)) {
+					cout << IO_ERR "Invalid stack limit" IO_NORM IO_END;
+					return 1;
+				} else {
+					executorSettings.stackLimit = uInt;
+					i++;
+				}
+				break;
+
+			case 26: // -snapshotat
+				if (argc - i < 3) {
+					cout << IO_ERR "Not enough arguments for setting snapshot label" IO_NORM IO_END;
+					return 1;
+				} else {
+					executorSettings.snapshotLabel = args[i + 1];
+					executorSettings.snapshotPath = args[i + 2];
+					i += 2;
+				}
+				break;
+
+			case 27: // -restore
+				if (argc - i < 2) {
+					cout << IO_ERR "Not enough arguments for restoring a snapshot" IO_NORM IO_END;
+					return 1;
+				} else {
+					if (vm::executor::restore(args[i + 1], executorSettings)) return 1;
+					i++;
+				}
+				break;
+
+			case 28: // -verify
+				executorSettings.verify = true;
+				break;
+
+			case 29: // -noverify
+				executorSettings.verify = false;
+				break;
 		}
 	}
 
@@ -1,7 +1,10 @@
 #pragma once
 
 #include "utils.h"
-#include "VM\vm.h"
-#include "VM\assembler.h"
-#include "VM\executor.h"
-#include "Compiler\compiler.h"
\ No newline at end of file
+#include "VM/vm.h"
+#include "VM/assembler.h"
+#include "VM/executor.h"
+#include "VM/aot.h"
+#include "VM/batch.h"
+#include "VM/snapshot.h"
+#include "Compiler/compiler.h"
\ No newline at end of file
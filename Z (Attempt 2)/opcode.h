@@ -90,11 +90,51 @@ namespace opcode {
 		//
 		TIME,
 		// 
+		SPAWN,
+		JOIN,
+		YIELD,
+		//
+		FLUSH,
+		//
+		MEM_CPY,
+		MEM_MOVE,
+		MEM_SET,
+		MEM_CMP,
+		//
+		V_LOAD,
+		V_STORE,
+		V_SPLAT,
+		VI_ADD,
+		VI_SUB,
+		VI_MUL,
+		VI_DIV,
+		VI_MIN,
+		VI_MAX,
+		VI_SUM,
+		VF_ADD,
+		VF_SUB,
+		VF_MUL,
+		VF_DIV,
+		VF_MIN,
+		VF_MAX,
+		VF_SUM,
+		//
+		STR_LEN,
+		STR_CMP,
+		STR_CHR,
+		STR_CPY,
+		LSTR_CMP,
+		LSTR_CHR,
+		LSTR_CPY,
+		//
+		CALL,
+		RET,
 		//
 		//
 		GLOBAL_W,
 		GLOBAL_B,
 		GLOBAL_STR,
+		GLOBAL_LSTR,
 
 		INVALID = 255
 	};
@@ -194,11 +234,51 @@ namespace opcode {
 		//
 		"time",
 		// 
+		"spawn",
+		"join",
+		"yield",
+		//
+		"flush",
+		//
+		"memcpy",
+		"memmove",
+		"memset",
+		"memcmp",
+		//
+		"vload",
+		"vstore",
+		"vsplat",
+		"viadd",
+		"visub",
+		"vimul",
+		"vidiv",
+		"vimin",
+		"vimax",
+		"visum",
+		"vfadd",
+		"vfsub",
+		"vfmul",
+		"vfdiv",
+		"vfmin",
+		"vfmax",
+		"vfsum",
+		//
+		"strlen",
+		"strcmp",
+		"strchr",
+		"strcpy",
+		"lstrcmp",
+		"lstrchr",
+		"lstrcpy",
+		//
+		"call",
+		"ret",
 		//
 		//
 		"globalw",
 		"globalb",
-		"globalstr"
+		"globalstr",
+		"globallstr"
 	};
 
 	constexpr int count = sizeof(strings) / sizeof(strings[0]);
@@ -211,7 +291,8 @@ namespace opcode {
 		ARG_WORD,		// 3 (Also processes labels)
 		ARG_BYTE,		// 4
 		ARG_VAR,		// 5 (Only for setting vars, use ARG_WORD for reading them)
-		ARG_STR			// 6
+		ARG_STR,		// 6
+		ARG_VEC_REG		// 7
 	};
 	constexpr int args[][MAX_ARGS] = {
 		{0, 0, 0},	// NOP
@@ -304,10 +385,50 @@ namespace opcode {
 		//
 		{1, 0, 0},	// TIME
 		// 
+		{1, 3, 0},	// SPAWN
+		{1, 1, 0},	// JOIN
+		{0, 0, 0},	// YIELD
+		//
+		{0, 0, 0},	// FLUSH
+		//
+		{1, 1, 1},	// MEM_CPY
+		{1, 1, 1},	// MEM_MOVE
+		{1, 2, 1},	// MEM_SET
+		{1, 1, 1},	// MEM_CMP
+		//
+		{7, 1, 3},	// V_LOAD
+		{1, 3, 7},	// V_STORE
+		{7, 1, 0},	// V_SPLAT
+		{7, 7, 7},	// VI_ADD
+		{7, 7, 7},	// VI_SUB
+		{7, 7, 7},	// VI_MUL
+		{7, 7, 7},	// VI_DIV
+		{7, 7, 7},	// VI_MIN
+		{7, 7, 7},	// VI_MAX
+		{1, 7, 0},	// VI_SUM
+		{7, 7, 7},	// VF_ADD
+		{7, 7, 7},	// VF_SUB
+		{7, 7, 7},	// VF_MUL
+		{7, 7, 7},	// VF_DIV
+		{7, 7, 7},	// VF_MIN
+		{7, 7, 7},	// VF_MAX
+		{1, 7, 0},	// VF_SUM
+		//
+		{1, 1, 0},	// STR_LEN
+		{1, 1, 0},	// STR_CMP
+		{1, 1, 2},	// STR_CHR
+		{1, 1, 0},	// STR_CPY
+		{1, 1, 0},	// LSTR_CMP
+		{1, 1, 2},	// LSTR_CHR
+		{1, 1, 0},	// LSTR_CPY
+		//
+		{3, 3, 0},	// CALL
+		{0, 0, 0},	// RET
 		// 
 		//
 		{5, 3, 0},	// GLOBAL_W
 		{5, 4, 0},	// GLOBAL_B
 		{5, 6, 0},	// GLOBAL_STR
+		{5, 6, 0},	// GLOBAL_LSTR
 	};
 }
\ No newline at end of file
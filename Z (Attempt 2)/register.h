@@ -28,4 +28,12 @@ namespace register_ {
 
 	constexpr int NUM_WORD_REGISTERS = 14;
 	constexpr int NUM_BYTE_REGISTERS = 14;
+
+	// ~~~~~~~~~~~~~~~~~~~~~~~~~~~
+	// Vector registers, a file of their own
+	// Register | ID		| Desc
+	// 0 ... 7	| V0 .. 7	| 128 bits: four word lanes, used as integers or floats by the vector opcodes
+
+	constexpr int NUM_VECTOR_REGISTERS = 8;
+	constexpr int VECTOR_LANES = 4;
 }
\ No newline at end of file
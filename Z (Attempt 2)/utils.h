@@ -34,6 +34,7 @@
 #define IO_WARN IO_YELLOW "[WARNING] "
 #define IO_MAIN IO_GREEN "[MAIN] "
 #define IO_DEBUG IO_CYAN "[DEBUG] "
+#define IO_PROFILE IO_MAGENTA "[PROFILE] "
 
 #define IO_HEX std::hex
 #define IO_DEC std::dec
@@ -103,7 +104,11 @@ namespace types {
 		bool_t bool_;
 	};
 
-	static_assert(sizeof(std::intptr_t) == sizeof(word_t), "No workaround for non-word-size (32-bit) pointers");
+	// Vector: lanes of words
+	struct alignas(16) VecVal {
+		WordVal lane[register_::VECTOR_LANES];
+	};
+
 	static_assert(sizeof(float) == sizeof(word_t), "No workaround for non-word-size (32-bit) floats");
 }
 